@@ -0,0 +1,30 @@
+#version 330 core
+
+// input data : sent from main program
+layout (location = 0) in vec3 vertexPosition;
+layout (location = 2) in vec2 vertexTexCoord;
+// per-instance data : tile offset (x,z), obstacle weight, visible flag (unused here)
+layout (location = 3) in vec4 tileInstance;
+// per-instance texture array layer
+layout (location = 4) in float tileLayer;
+
+uniform mat4 MVP;            // Projection * View, shared by every tile
+uniform mat4 tileRotation;   // Model rotation, shared by every tile
+uniform float obstacleHeight;
+
+// output data : used by fragment shader
+out vec3 fragTexCoord;
+
+void main ()
+{
+    // Holes are skipped when the instance buffers are built, every instance is drawn
+    vec4 v = tileRotation * vec4(vertexPosition, 1);
+
+    // Obstacle tiles follow the moving height, the rest stay at y = 0
+    v.xyz += vec3(tileInstance.x, tileInstance.z * obstacleHeight, tileInstance.y);
+
+    fragTexCoord = vec3(vertexTexCoord, tileLayer);
+
+    // Output position of the vertex, in clip space : MVP * position
+    gl_Position = MVP * v;
+}
@@ -1,7 +1,25 @@
 #include <iostream>
 #include <cmath>
 #include <fstream>
+#include <sstream>
 #include <vector>
+#include <algorithm>
+#include <map>
+#include <cstring>
+#include <cstdio>
+#include <cctype>
+#include <climits>
+#include <stdint.h>
+#include <cstddef>
+#include <chrono>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
 
 #define GLM_FORCE_RADIANS
 #include <glm/glm.hpp>
@@ -9,10 +27,22 @@
 #include <glm/gtc/matrix_transform.hpp>
 
 #include <glad/glad.h>
-#include <FTGL/ftgl.h>
+#include <ft2build.h>
+#include FT_FREETYPE_H
 #include <GLFW/glfw3.h>
 #include <SOIL/SOIL.h>
 #include <SFML/Audio.hpp>
+#ifdef USE_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "game_sim.h"
+#include "asset_pack.h"
 using namespace std;
 
 #define PI 3.14159
@@ -22,120 +52,785 @@ struct VAO {
 	GLuint VertexBuffer;
 	GLuint ColorBuffer;
 	GLuint TextureBuffer;
-	GLuint TextureID;
+	GLuint IndexBuffer; // 0 for non-indexed geometry
+	GLuint TextureID; // GL_TEXTURE_2D_ARRAY shared by all textured meshes
+	int TextureLayer; // layer of TextureID this mesh samples
 
 	GLenum PrimitiveMode; // GL_POINTS, GL_LINE_STRIP, GL_LINE_LOOP, GL_LINES, GL_LINE_STRIP_ADJACENCY, GL_LINES_ADJACENCY, GL_TRIANGLE_STRIP, GL_TRIANGLE_FAN, GL_TRIANGLES, GL_TRIANGLE_STRIP_ADJACENCY and GL_TRIANGLES_ADJACENCY
 	GLenum FillMode; // GL_FILL, GL_LINE
-	int NumVertices;
+	GLenum IndexType; // GL_UNSIGNED_BYTE, GL_UNSIGNED_SHORT
+	int NumVertices; // number of indices for indexed geometry
+	glm::vec3 BoundsMin, BoundsMax; // model space box around the vertices, for culling
 };
 typedef struct VAO VAO;
 
-sf::SoundBuffer buffer1;
-sf::SoundBuffer buffer2;
-sf::SoundBuffer buffer3;
-sf::SoundBuffer buffer4;
-sf::SoundBuffer buffer5;
-sf::SoundBuffer buffer6;
-sf::SoundBuffer buffer7;
-sf::Sound sound1;
-sf::Sound sound2;
-sf::Sound sound3;
-sf::Sound sound4;
-sf::Sound sound5;
-sf::Sound sound6;
-sf::Sound sound7;
-
 struct GLMatrices {
 	glm::mat4 projection;
 	glm::mat4 model;
 	glm::mat4 view;
-	GLuint MatrixID; // For use with normal shader
-	GLuint TexMatrixID; // For use with texture shader
+	int MatrixID; // For use with normal shader
+	int TexMatrixID; // For use with texture shader
+	int TexSamplerID; // For use with texture shader
 } Matrices;
 
-struct FTGLFont {
-	FTFont* font;
-	GLuint fontMatrixID;
-	GLuint fontColorID;
-} GL3Font;
+/* 64 bit FNV-1a hash, seeded so that hashes can be chained */
+uint64_t hashBytes (const void* data, size_t bytes, uint64_t seed=14695981039346656037ULL)
+{
+	const unsigned char* p = (const unsigned char*) data;
+	uint64_t h = seed;
+	for (size_t i=0; i<bytes; i++) {
+		h ^= p[i];
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
 
-GLuint programID, fontProgramID, textureProgramID;
+/* Seconds from a monotonic clock, usable without GLFW (offscreen EGL runs never initialise it) */
+double getTime ()
+{
+	return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
 
-/* Function to load Shaders - Use it as it is */
-GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path) {
+/* Asset pack : assets.pak (see asset_pack.h) is mapped once at startup and the loaders
+ * read their files straight from the mapping. Without a pack they read the loose files. */
+struct AssetPack {
+	const unsigned char* data; // NULL when no pack is open
+	size_t size;
+	const PackEntry* entries;
+	uint32_t count;
+	time_t modified;           // stands in for the modification time of every packed file
+	atomic<int> served;        // reads answered from the pack
+	atomic<int> looseFiles;    // reads that had to open a file
+} assetPack;
+
+/* Map 'path' and check its header, false leaves the loaders on loose files */
+bool openAssetPack (const char* path)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return false;
+	struct stat info;
+	void* mapping = MAP_FAILED;
+	if (fstat(fd, &info) == 0 && info.st_size >= (off_t) sizeof(PackHeader))
+		mapping = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (mapping == MAP_FAILED)
+		return false;
+
+	const PackHeader* header = (const PackHeader*) mapping;
+	if (memcmp(header->magic, "APAK", 4) != 0 || header->version != PACK_VERSION ||
+		sizeof(PackHeader) + header->count*sizeof(PackEntry) > (size_t) info.st_size) {
+		cout << "Ignoring " << path << ", it is not a version " << PACK_VERSION << " asset pack" << endl;
+		munmap(mapping, info.st_size);
+		return false;
+	}
+	assetPack.data = (const unsigned char*) mapping;
+	assetPack.size = info.st_size;
+	assetPack.entries = (const PackEntry*) (header + 1);
+	assetPack.count = header->count;
+	assetPack.modified = info.st_mtime;
+	return true;
+}
+
+bool comparePackEntry (const PackEntry& entry, uint64_t nameHash)
+{
+	return entry.nameHash < nameHash;
+}
+
+/* Open assets.pak from the working directory, where the caches live, else from the
+ * directory of the executable (found through /proc, so also when started from PATH) */
+bool findAssetPack ()
+{
+	if (openAssetPack("assets.pak"))
+		return true;
+	char exe[PATH_MAX];
+	ssize_t length = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+	if (length <= 0)
+		return false;
+	string packPath(exe, length);
+	packPath = packPath.substr(0, packPath.rfind('/') + 1) + "assets.pak";
+	return openAssetPack(packPath.c_str());
+}
+
+/* Index entry of 'name', NULL when there is no pack or the pack lacks it */
+const PackEntry* findPackedFile (const char* name)
+{
+	if (!assetPack.data)
+		return NULL;
+	uint64_t hash = packNameHash(name);
+	const PackEntry* end = assetPack.entries + assetPack.count;
+	const PackEntry* entry = lower_bound(assetPack.entries, end, hash, comparePackEntry);
+	if (entry == end || entry->nameHash != hash || entry->compression != PACK_STORED ||
+		entry->offset > assetPack.size || entry->size > assetPack.size - entry->offset)
+		return NULL;
+	return entry;
+}
+
+/* Contents of an asset : a view of the mapped pack, else the loose file read into 'storage' */
+bool readAssetFile (const char* name, const unsigned char*& data, size_t& size, vector<unsigned char>& storage)
+{
+	const PackEntry* entry = findPackedFile(name);
+	if (entry) {
+		data = assetPack.data + entry->offset;
+		size = entry->size;
+		assetPack.served++;
+		return true;
+	}
+	ifstream in(name, ios::binary);
+	if (!in.is_open())
+		return false;
+	storage.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+	data = storage.empty() ? NULL : &storage[0];
+	size = storage.size();
+	assetPack.looseFiles++;
+	return true;
+}
+
+/* Size and modification time of an asset, packed files carry the time of the pack */
+bool statAssetFile (const char* name, struct stat& info)
+{
+	const PackEntry* entry = findPackedFile(name);
+	if (!entry)
+		return stat(name, &info) == 0;
+	memset(&info, 0, sizeof(info));
+	info.st_size = entry->size;
+	info.st_mtime = assetPack.modified;
+	return true;
+}
+
+/* Audio : effects play on a pool of voices owned by an audio thread. Gameplay code only
+ * pushes commands into a lock-free queue, so no SFML object is touched while rendering. */
+enum SoundEffect {
+	SFX_JUMP,     // jump.wav
+	SFX_WALK,     // walk.wav, every move
+	SFX_WIN,      // final.wav, last level cleared
+	SFX_FALL,     // hole.wav, into a hole or off the board
+	SFX_OBSTACLE, // obstac.wav
+	SFX_COUNT
+};
+
+enum MusicTrack {
+	MUSIC_BACKGROUND, // my.wav
+	MUSIC_LEVEL_UP,   // lvl.wav
+	MUSIC_COUNT
+};
 
-	// Create the shaders
-	GLuint VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
-	GLuint FragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
+struct SoundEffectDesc {
+	int priority;    // may steal a voice playing an effect of this priority or lower
+	double cooldown; // seconds before the same effect can start again
+};
+
+/* Indexed by SoundEffect */
+const SoundEffectDesc soundEffects[SFX_COUNT] = {
+	{ 2, 0.10 }, // SFX_JUMP
+	{ 1, 0.06 }, // SFX_WALK
+	{ 4, 0.50 }, // SFX_WIN
+	{ 3, 0.10 }, // SFX_FALL
+	{ 3, 0.10 }, // SFX_OBSTACLE
+};
+
+sf::SoundBuffer effectBuffers[SFX_COUNT];
 
-	// Read the Vertex Shader code from the file
-	std::string VertexShaderCode;
-	std::ifstream VertexShaderStream(vertex_file_path, std::ios::in);
-	if(VertexShaderStream.is_open())
+/* Background tracks are not decoded into a SoundBuffer : the WAV file is memory mapped (as
+ * part of the asset pack or on its own) and its 16 bit PCM samples are handed to OpenAL a
+ * quarter second at a time, straight from the mapping. Only the chunks OpenAL has queued are resident, the rest stays on disk. */
+const int STREAM_CHUNKS_PER_SECOND = 4;
+const int STREAM_QUEUED_CHUNKS = 3; // sf::SoundStream keeps this many buffers queued
+
+class MappedWavStream : public sf::SoundStream {
+public:
+	MappedWavStream () : mapping(NULL), mappingSize(0), samples(NULL), sampleCount(0), position(0) {}
+	~MappedWavStream ()
 	{
-		std::string Line = "";
-		while(getline(VertexShaderStream, Line))
-			VertexShaderCode += "\n" + Line;
-		VertexShaderStream.close();
+		stop(); // the stream thread reads the mapping
+		if (mapping)
+			munmap(mapping, mappingSize);
 	}
 
-	// Read the Fragment Shader code from the file
-	std::string FragmentShaderCode;
-	std::ifstream FragmentShaderStream(fragment_file_path, std::ios::in);
-	if(FragmentShaderStream.is_open()){
-		std::string Line = "";
-		while(getline(FragmentShaderStream, Line))
-			FragmentShaderCode += "\n" + Line;
-		FragmentShaderStream.close();
+	/* Find the samples of 'filename' in the asset pack, or map the loose file.
+	 * False unless it is a 16 bit PCM WAV. */
+	bool open (const char* filename)
+	{
+		const PackEntry* entry = findPackedFile(filename);
+		if (entry) {
+			assetPack.served++;
+			return parse(assetPack.data + entry->offset, entry->size);
+		}
+
+		int fd = ::open(filename, O_RDONLY);
+		if (fd < 0)
+			return false;
+		struct stat info;
+		if (fstat(fd, &info) == 0 && info.st_size > 12)
+			mapping = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (!mapping || mapping == MAP_FAILED) {
+			mapping = NULL;
+			return false;
+		}
+		mappingSize = info.st_size;
+		madvise(mapping, mappingSize, MADV_SEQUENTIAL);
+		assetPack.looseFiles++;
+		return parse((const unsigned char*) mapping, mappingSize);
 	}
 
-	GLint Result = GL_FALSE;
-	int InfoLogLength;
+	/* Bytes of samples kept in memory while playing, and bytes the whole track decodes to */
+	size_t residentBytes () const { return STREAM_QUEUED_CHUNKS * chunkSamples * sizeof(sf::Int16); }
+	size_t decodedBytes () const { return sampleCount * sizeof(sf::Int16); }
+
+protected:
+	/* Walk the RIFF chunks : "fmt " describes the samples, "data" holds them */
+	bool parse (const unsigned char* file, size_t fileSize)
+	{
+		if (fileSize < 12 || memcmp(file, "RIFF", 4) != 0 || memcmp(file + 8, "WAVE", 4) != 0)
+			return false;
+		unsigned channels = 0, rate = 0, bits = 0, format = 0;
+		for (size_t at = 12; at + 8 <= fileSize; ) {
+			uint32_t size = file[at+4] | file[at+5] << 8 | file[at+6] << 16 | (uint32_t) file[at+7] << 24;
+			const unsigned char* body = file + at + 8;
+			if (memcmp(file + at, "fmt ", 4) == 0 && size >= 16 && at + 8 + 16 <= fileSize) {
+				format = body[0] | body[1] << 8;
+				channels = body[2] | body[3] << 8;
+				rate = body[4] | body[5] << 8 | body[6] << 16 | (uint32_t) body[7] << 24;
+				bits = body[14] | body[15] << 8;
+			}
+			else if (memcmp(file + at, "data", 4) == 0) {
+				samples = (const sf::Int16*) body;
+				sampleCount = min((size_t) size, fileSize - (at + 8)) / sizeof(sf::Int16);
+			}
+			at += 8 + size + (size & 1);
+		}
+		if (format != 1 || bits != 16 || channels == 0 || rate == 0 || !samples)
+			return false;
+
+		chunkSamples = rate / STREAM_CHUNKS_PER_SECOND * channels;
+		initialize(channels, rate);
+		return true;
+	}
+
+	/* Called on the SFML stream thread : point OpenAL at the next chunk of the mapping */
+	bool onGetData (Chunk& data)
+	{
+		data.samples = samples + position;
+		data.sampleCount = min(chunkSamples, sampleCount - position);
+		position += data.sampleCount;
+		return data.sampleCount > 0;
+	}
+
+	void onSeek (sf::Time offset)
+	{
+		size_t frame = (size_t) (offset.asSeconds() * getSampleRate());
+		position = min(frame * getChannelCount(), sampleCount);
+	}
+
+private:
+	void* mapping; // a loose file mapped by open, NULL for packed tracks
+	size_t mappingSize;
+	const sf::Int16* samples; // little endian, which is every platform this builds on
+	size_t sampleCount;
+	size_t chunkSamples;
+	size_t position;
+};
+
+MappedWavStream musicTracks[MUSIC_COUNT];
+
+/* One request from the game to the audio thread */
+struct AudioCommand {
+	enum { PLAY_EFFECT, PLAY_MUSIC } type;
+	int id; // SoundEffect or MusicTrack
+};
+
+/* Single producer (the main thread), single consumer (the audio thread) ring buffer.
+ * head and tail only ever grow, the slot is their value modulo the size. */
+const unsigned AUDIO_QUEUE_SIZE = 64;
+
+struct AudioQueue {
+	AudioCommand commands[AUDIO_QUEUE_SIZE];
+	atomic<unsigned> head; // next slot the main thread writes
+	atomic<unsigned> tail; // next slot the audio thread reads
+} audioQueue;
+
+/* A fixed set of sf::Sound, so effects overlap instead of restarting each other */
+const int AUDIO_VOICES = 8;
+
+struct Voice {
+	sf::Sound sound;
+	int effect;       // SFX_COUNT while unused
+	double startTime;
+};
+
+struct AudioMixer {
+	Voice voices[AUDIO_VOICES];
+	double lastStart[SFX_COUNT]; // for the cooldowns
+	thread worker;
+	atomic<bool> running;
+	atomic<int> queueFull;       // written by the main thread
+	int played, stolen, cooledDown, noVoice;
+} audio;
+
+/* Queue a command from the main thread, never blocks : a full queue drops it */
+void pushAudioCommand (const AudioCommand& command)
+{
+	unsigned head = audioQueue.head.load(memory_order_relaxed);
+	if (head - audioQueue.tail.load(memory_order_acquire) == AUDIO_QUEUE_SIZE) {
+		audio.queueFull++;
+		return;
+	}
+	audioQueue.commands[head % AUDIO_QUEUE_SIZE] = command;
+	audioQueue.head.store(head + 1, memory_order_release);
+}
+
+bool popAudioCommand (AudioCommand& command)
+{
+	unsigned tail = audioQueue.tail.load(memory_order_relaxed);
+	if (tail == audioQueue.head.load(memory_order_acquire))
+		return false;
+	command = audioQueue.commands[tail % AUDIO_QUEUE_SIZE];
+	audioQueue.tail.store(tail + 1, memory_order_release);
+	return true;
+}
+
+void playEffect (SoundEffect effect)
+{
+	AudioCommand command = { AudioCommand::PLAY_EFFECT, effect };
+	pushAudioCommand(command);
+}
+
+void playMusic (MusicTrack track)
+{
+	AudioCommand command = { AudioCommand::PLAY_MUSIC, track };
+	pushAudioCommand(command);
+}
+
+/* Voice for a new effect : a free one, else the oldest of the lowest priority playing,
+ * provided that priority does not exceed the new effect's. NULL drops the effect. */
+Voice* chooseVoice (int priority)
+{
+	Voice* victim = NULL;
+	for (int v=0; v<AUDIO_VOICES; v++) {
+		Voice& voice = audio.voices[v];
+		if (voice.effect == SFX_COUNT || voice.sound.getStatus() == sf::SoundSource::Stopped)
+			return &voice;
+		int voicePriority = soundEffects[voice.effect].priority;
+		if (voicePriority > priority)
+			continue;
+		if (!victim || voicePriority < soundEffects[victim->effect].priority ||
+			(voicePriority == soundEffects[victim->effect].priority && voice.startTime < victim->startTime))
+			victim = &voice;
+	}
+	if (victim)
+		audio.stolen++;
+	return victim;
+}
+
+/* Audio thread half of playEffect */
+void startEffect (int effect, double now)
+{
+	const SoundEffectDesc& desc = soundEffects[effect];
+	if (now - audio.lastStart[effect] < desc.cooldown) {
+		audio.cooledDown++;
+		return;
+	}
+	Voice* voice = chooseVoice(desc.priority);
+	if (!voice) {
+		audio.noVoice++;
+		return;
+	}
+	voice->sound.stop();
+	voice->sound.setBuffer(effectBuffers[effect]);
+	voice->sound.play();
+	voice->effect = effect;
+	voice->startTime = now;
+	audio.lastStart[effect] = now;
+	audio.played++;
+}
+
+/* The only thread that touches the voices and music tracks */
+void audioThread ()
+{
+	while (audio.running) {
+		AudioCommand command;
+		bool idle = true;
+		while (popAudioCommand(command)) {
+			if (command.type == AudioCommand::PLAY_EFFECT)
+				startEffect(command.id, getTime());
+			else
+				musicTracks[command.id].play();
+			idle = false;
+		}
+		if (idle)
+			this_thread::sleep_for(chrono::milliseconds(2));
+	}
+}
+
+/* Start the audio thread, once the sound buffers are loaded */
+void startAudio ()
+{
+	for (int v=0; v<AUDIO_VOICES; v++)
+		audio.voices[v].effect = SFX_COUNT;
+	for (int e=0; e<SFX_COUNT; e++)
+		audio.lastStart[e] = -1e9;
+	audio.running = true;
+	audio.worker = thread(audioThread);
+}
+
+void stopAudio ()
+{
+	if (!audio.worker.joinable())
+		return;
+	audio.running = false;
+	audio.worker.join();
+	for (int v=0; v<AUDIO_VOICES; v++)
+		audio.voices[v].sound.stop();
+	for (int t=0; t<MUSIC_COUNT; t++)
+		musicTracks[t].stop();
+	cout << "Audio: " << audio.played << " effects played on " << AUDIO_VOICES << " voices, " << audio.stolen << " voices stolen, "
+		 << audio.cooledDown << " skipped by cooldowns, " << audio.noVoice + audio.queueFull << " dropped" << endl;
+}
+
+/* Program binary cache : linked programs are saved with glGetProgramBinary in
+ * shader_cache/, keyed by a hash of both sources and the driver, and reloaded with
+ * glProgramBinary on the next launch. Anything the driver rejects is compiled again. */
+bool shaderCacheEnabled = true;
+const char* SHADER_CACHE_DIR = "shader_cache";
+
+struct ProgramBinaryHeader {
+	char magic[4];   // "PBIN"
+	GLenum format;
+	GLint length;
+	float buildMs;   // what building it from source took, for the startup report
+};
+
+/* A program whose compile and link may still be running in the driver */
+struct PendingProgram {
+	string vertexPath, fragmentPath;
+	GLuint ProgramID, VertexShaderID, FragmentShaderID;
+	uint64_t key;
+	bool fromCache;
+	float cachedBuildMs;
+	double buildMs; // time spent issuing and waiting for this program
+};
+
+struct ShaderStartupStats {
+	int programs, cacheHits;
+	double ms, savedMs;
+} shaderStats;
+
+string readShaderSource (const char* path)
+{
+	const unsigned char* data;
+	size_t size;
+	vector<unsigned char> storage;
+	if (!readAssetFile(path, data, size, storage))
+		return string();
+	return string((const char*) data, size);
+}
+
+bool programBinarySupported ()
+{
+	static int supported = -1;
+	if (supported < 0) {
+		GLint formats = 0;
+		if (GLAD_GL_ARB_get_program_binary || GLAD_GL_VERSION_4_1)
+			glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+		supported = formats > 0;
+	}
+	return supported;
+}
+
+string programCachePath (uint64_t key)
+{
+	char name[64];
+	snprintf(name, sizeof(name), "/%016llx.bin", (unsigned long long) key);
+	return SHADER_CACHE_DIR + string(name);
+}
+
+/* Try the cached binary, true if the driver accepted it */
+bool loadProgramBinary (PendingProgram& p)
+{
+	ifstream in(programCachePath(p.key).c_str(), ios::binary);
+	ProgramBinaryHeader header;
+	if (!in.read((char*) &header, sizeof(header)) || memcmp(header.magic, "PBIN", 4) != 0 || header.length <= 0)
+		return false;
+	vector<char> binary(header.length);
+	if (!in.read(&binary[0], header.length))
+		return false;
+
+	glProgramBinary(p.ProgramID, header.format, &binary[0], header.length);
+	GLint linked = GL_FALSE;
+	glGetProgramiv(p.ProgramID, GL_LINK_STATUS, &linked);
+	p.cachedBuildMs = header.buildMs;
+	return linked == GL_TRUE;
+}
+
+void saveProgramBinary (const PendingProgram& p)
+{
+	GLint length = 0;
+	glGetProgramiv(p.ProgramID, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0)
+		return;
+	ProgramBinaryHeader header;
+	memcpy(header.magic, "PBIN", 4);
+	header.length = length;
+	header.buildMs = p.buildMs;
+	vector<char> binary(length);
+	glGetProgramBinary(p.ProgramID, length, NULL, &header.format, &binary[0]);
+
+	mkdir(SHADER_CACHE_DIR, 0755);
+	ofstream out(programCachePath(p.key).c_str(), ios::binary);
+	out.write((const char*) &header, sizeof(header));
+	out.write(&binary[0], length);
+}
+
+/* Let the driver compile on its own threads, so that programs started together build together */
+void enableParallelShaderCompile ()
+{
+	if (GLAD_GL_ARB_parallel_shader_compile)
+		glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+}
+
+/* Issue the compile and link without waiting for the result, see finishShaderProgram */
+PendingProgram beginShaderProgram (const char * vertex_file_path,const char * fragment_file_path)
+{
+	double start = getTime();
+	PendingProgram p;
+	p.vertexPath = vertex_file_path;
+	p.fragmentPath = fragment_file_path;
+	p.VertexShaderID = p.FragmentShaderID = 0;
+	p.fromCache = false;
+	p.cachedBuildMs = 0;
+	p.ProgramID = glCreateProgram();
+
+	string VertexShaderCode = readShaderSource(vertex_file_path);
+	string FragmentShaderCode = readShaderSource(fragment_file_path);
+
+	// Binaries are only valid for the driver that produced them
+	const char* renderer = (const char*) glGetString(GL_RENDERER);
+	const char* version = (const char*) glGetString(GL_VERSION);
+	p.key = hashBytes(VertexShaderCode.data(), VertexShaderCode.size());
+	p.key = hashBytes(FragmentShaderCode.data(), FragmentShaderCode.size(), p.key);
+	p.key = hashBytes(renderer, strlen(renderer), p.key);
+	p.key = hashBytes(version, strlen(version), p.key);
+
+	if (shaderCacheEnabled && programBinarySupported() && loadProgramBinary(p)) {
+		p.fromCache = true;
+		p.buildMs = (getTime() - start) * 1000.0;
+		return p;
+	}
 
-	// Compile Vertex Shader
-	cout << "Compiling shader : " <<  vertex_file_path << endl;
+	p.VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
+	p.FragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
 	char const * VertexSourcePointer = VertexShaderCode.c_str();
-	glShaderSource(VertexShaderID, 1, &VertexSourcePointer , NULL);
-	glCompileShader(VertexShaderID);
-
-	// Check Vertex Shader
-	glGetShaderiv(VertexShaderID, GL_COMPILE_STATUS, &Result);
-	glGetShaderiv(VertexShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
-	std::vector<char> VertexShaderErrorMessage( max(InfoLogLength, int(1)) );
-	glGetShaderInfoLog(VertexShaderID, InfoLogLength, NULL, &VertexShaderErrorMessage[0]);
-	cout << VertexShaderErrorMessage.data() << endl;
-
-	// Compile Fragment Shader
-	cout << "Compiling shader : " << fragment_file_path << endl;
+	glShaderSource(p.VertexShaderID, 1, &VertexSourcePointer , NULL);
+	glCompileShader(p.VertexShaderID);
 	char const * FragmentSourcePointer = FragmentShaderCode.c_str();
-	glShaderSource(FragmentShaderID, 1, &FragmentSourcePointer , NULL);
-	glCompileShader(FragmentShaderID);
+	glShaderSource(p.FragmentShaderID, 1, &FragmentSourcePointer , NULL);
+	glCompileShader(p.FragmentShaderID);
+
+	glAttachShader(p.ProgramID, p.VertexShaderID);
+	glAttachShader(p.ProgramID, p.FragmentShaderID);
+	if (programBinarySupported())
+		glProgramParameteri(p.ProgramID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	glLinkProgram(p.ProgramID);
+
+	p.buildMs = (getTime() - start) * 1000.0;
+	return p;
+}
 
-	// Check Fragment Shader
-	glGetShaderiv(FragmentShaderID, GL_COMPILE_STATUS, &Result);
-	glGetShaderiv(FragmentShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
-	std::vector<char> FragmentShaderErrorMessage( max(InfoLogLength, int(1)) );
-	glGetShaderInfoLog(FragmentShaderID, InfoLogLength, NULL, &FragmentShaderErrorMessage[0]);
-	cout << FragmentShaderErrorMessage.data() << endl;
+/* Print a shader or program info log, if the driver wrote one */
+void printInfoLog (GLuint id, bool program)
+{
+	int InfoLogLength = 0;
+	if (program)
+		glGetProgramiv(id, GL_INFO_LOG_LENGTH, &InfoLogLength);
+	else
+		glGetShaderiv(id, GL_INFO_LOG_LENGTH, &InfoLogLength);
+	if (InfoLogLength <= 1)
+		return;
+	std::vector<char> ErrorMessage(InfoLogLength);
+	if (program)
+		glGetProgramInfoLog(id, InfoLogLength, NULL, &ErrorMessage[0]);
+	else
+		glGetShaderInfoLog(id, InfoLogLength, NULL, &ErrorMessage[0]);
+	cout << ErrorMessage.data() << endl;
+}
 
-	// Link the program
+/* Wait for the program to finish building, report it and store its binary */
+GLuint finishShaderProgram (PendingProgram& p)
+{
+	double start = getTime();
+	shaderStats.programs++;
+
+	if (p.fromCache) {
+		shaderStats.cacheHits++;
+		shaderStats.ms += p.buildMs;
+		shaderStats.savedMs += p.cachedBuildMs - p.buildMs;
+		cout << "Loaded program : " << p.vertexPath << " + " << p.fragmentPath << " (cached)" << endl;
+		return p.ProgramID;
+	}
+
+	// The first status query is where the driver makes us wait
+	GLint Result = GL_FALSE;
+	cout << "Compiling shader : " << p.vertexPath << endl;
+	printInfoLog(p.VertexShaderID, false);
+	cout << "Compiling shader : " << p.fragmentPath << endl;
+	printInfoLog(p.FragmentShaderID, false);
 	cout << "Linking program" << endl;
-	GLuint ProgramID = glCreateProgram();
-	glAttachShader(ProgramID, VertexShaderID);
-	glAttachShader(ProgramID, FragmentShaderID);
-	glLinkProgram(ProgramID);
+	glGetProgramiv(p.ProgramID, GL_LINK_STATUS, &Result);
+	printInfoLog(p.ProgramID, true);
+
+	glDetachShader(p.ProgramID, p.VertexShaderID);
+	glDetachShader(p.ProgramID, p.FragmentShaderID);
+	glDeleteShader(p.VertexShaderID);
+	glDeleteShader(p.FragmentShaderID);
+
+	p.buildMs += (getTime() - start) * 1000.0;
+	shaderStats.ms += p.buildMs;
+	if (Result == GL_TRUE && shaderCacheEnabled && programBinarySupported())
+		saveProgramBinary(p);
+	return p.ProgramID;
+}
+
+/* Function to load Shaders - Use it as it is */
+GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path) {
+	PendingProgram p = beginShaderProgram(vertex_file_path, fragment_file_path);
+	return finishShaderProgram(p);
+}
+
+void printShaderStartupReport ()
+{
+	char line[160];
+	snprintf(line, sizeof(line), "Shaders: %d programs, %d from the binary cache, %.1f ms, %.1f ms saved over compiling from source",
+			 shaderStats.programs, shaderStats.cacheHits, shaderStats.ms, shaderStats.savedMs);
+	cout << line << endl;
+}
+
+/* Cached value of one active uniform, so repeated uploads of the same value are skipped */
+struct UniformSlot {
+	GLint location;
+	GLenum type;
+	bool valid; // false until the first upload
+	GLfloat value[16];
+};
+
+/* Linked program with every active uniform and attribute resolved at link time */
+struct ShaderProgram {
+	GLuint ProgramID;
+	map<string, int> uniformSlots;  // name -> index into uniforms
+	map<string, GLint> attributes;  // name -> attribute location
+	vector<UniformSlot> uniforms;
+	int uploadsIssued, uploadsSkipped;
+
+	/* Slot of a uniform, -1 if it is not active. Resolve once, not per frame */
+	int uniform (const string& name) const
+	{
+		map<string, int>::const_iterator it = uniformSlots.find(name);
+		return it == uniformSlots.end() ? -1 : it->second;
+	}
+
+	GLint uniformLocation (const string& name) const
+	{
+		int slot = uniform(name);
+		return slot < 0 ? -1 : uniforms[slot].location;
+	}
+
+	GLint attribute (const string& name) const
+	{
+		map<string, GLint>::const_iterator it = attributes.find(name);
+		return it == attributes.end() ? -1 : it->second;
+	}
+
+	/* True if 'count' floats differ from the cached value, which is then updated */
+	bool changed (int slot, const GLfloat* v, int count)
+	{
+		if (slot < 0)
+			return false;
+		UniformSlot& u = uniforms[slot];
+		if (u.valid && memcmp(u.value, v, count*sizeof(GLfloat)) == 0) {
+			uploadsSkipped++;
+			return false;
+		}
+		memcpy(u.value, v, count*sizeof(GLfloat));
+		u.valid = true;
+		uploadsIssued++;
+		return true;
+	}
 
-	// Check the program
-	glGetProgramiv(ProgramID, GL_LINK_STATUS, &Result);
-	glGetProgramiv(ProgramID, GL_INFO_LOG_LENGTH, &InfoLogLength);
-	std::vector<char> ProgramErrorMessage( max(InfoLogLength, int(1)) );
-	glGetProgramInfoLog(ProgramID, InfoLogLength, NULL, &ProgramErrorMessage[0]);
-	cout << ProgramErrorMessage.data() << endl;
+	/* Setters expect this program to be the one in use */
+	void setMat4 (int slot, const glm::mat4& m)
+	{
+		if (changed(slot, &m[0][0], 16))
+			glUniformMatrix4fv(uniforms[slot].location, 1, GL_FALSE, &m[0][0]);
+	}
+
+	void setVec3 (int slot, const glm::vec3& v)
+	{
+		if (changed(slot, &v[0], 3))
+			glUniform3fv(uniforms[slot].location, 1, &v[0]);
+	}
+
+	void setFloat (int slot, GLfloat v)
+	{
+		if (changed(slot, &v, 1))
+			glUniform1f(uniforms[slot].location, v);
+	}
+
+	void setInt (int slot, GLint v)
+	{
+		GLfloat f = (GLfloat) v;
+		if (changed(slot, &f, 1))
+			glUniform1i(uniforms[slot].location, v);
+	}
+};
+
+ShaderProgram colorProgram, fontProgram, textureProgram;
+
+/* Strip the "[0]" GL appends to the names of array uniforms */
+static string activeName (const char* name)
+{
+	string s(name);
+	size_t bracket = s.find('[');
+	return bracket == string::npos ? s : s.substr(0, bracket);
+}
 
-	glDeleteShader(VertexShaderID);
-	glDeleteShader(FragmentShaderID);
+/* Load, compile and link a program and cache all of its active uniforms and attributes */
+ShaderProgram createShaderProgram (PendingProgram& pending)
+{
+	ShaderProgram program;
+	program.ProgramID = finishShaderProgram(pending);
+	program.uploadsIssued = program.uploadsSkipped = 0;
+
+	GLint count, maxLength;
+	glGetProgramiv(program.ProgramID, GL_ACTIVE_UNIFORMS, &count);
+	glGetProgramiv(program.ProgramID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+	vector<char> name( max(maxLength, int(1)) );
+	for (GLint i=0; i<count; i++) {
+		GLint size;
+		UniformSlot u;
+		glGetActiveUniform(program.ProgramID, i, maxLength, NULL, &size, &u.type, &name[0]);
+		u.location = glGetUniformLocation(program.ProgramID, &name[0]);
+		u.valid = false;
+		program.uniformSlots[activeName(&name[0])] = program.uniforms.size();
+		program.uniforms.push_back(u);
+	}
+
+	glGetProgramiv(program.ProgramID, GL_ACTIVE_ATTRIBUTES, &count);
+	glGetProgramiv(program.ProgramID, GL_ACTIVE_ATTRIBUTE_MAX_LENGTH, &maxLength);
+	name.resize( max(maxLength, int(1)) );
+	for (GLint i=0; i<count; i++) {
+		GLint size;
+		GLenum type;
+		glGetActiveAttrib(program.ProgramID, i, maxLength, NULL, &size, &type, &name[0]);
+		program.attributes[activeName(&name[0])] = glGetAttribLocation(program.ProgramID, &name[0]);
+	}
 
-	return ProgramID;
+	return program;
+}
+
+ShaderProgram createShaderProgram (const char * vertex_file_path,const char * fragment_file_path)
+{
+	PendingProgram pending = beginShaderProgram(vertex_file_path, fragment_file_path);
+	return createShaderProgram(pending);
 }
 
 static void error_callback(int error, const char* description)
@@ -143,10 +838,17 @@ static void error_callback(int error, const char* description)
 	cout << "Error: " << description << endl;
 }
 
+void stopAssetLoader (); // joins the asset loader threads, see below
+
 void quit(GLFWwindow *window)
 {
-	glfwDestroyWindow(window);
-	glfwTerminate();
+	stopAudio();
+	stopAssetLoader();
+	// Offscreen EGL runs have no window and never initialised GLFW
+	if (window) {
+		glfwDestroyWindow(window);
+		glfwTerminate();
+	}
 	exit(EXIT_SUCCESS);
 }
 
@@ -170,23 +872,116 @@ glm::vec3 getRGBfromHue (int hue)
 		return glm::vec3(1,0,x);
 }
 
+/* Mesh registry - identical vertex data is uploaded once and shared */
+struct SharedBuffer {
+	GLuint BufferID;
+	vector<unsigned char> data; // kept to rule out hash collisions
+};
+
+struct MeshRegistryStats {
+	int buffersRequested, buffersCreated;
+	size_t bytesRequested, bytesUploaded;
+	int meshesRequested, meshesCreated;
+	int meshesPacked;                     // by packTexturedMesh
+	size_t unpackedBytes, packedBytes;    // float arrays in, vertices and indices out
+} meshStats;
+
+map<uint64_t, SharedBuffer> sharedBuffers;
+map<vector<GLuint>, struct VAO*> sharedMeshes;
+
+/* Return a VBO holding 'bytes' of 'data', reusing an existing one with the same content */
+GLuint acquireSharedBuffer (const void* data, size_t bytes)
+{
+	meshStats.buffersRequested++;
+	meshStats.bytesRequested += bytes;
+
+	uint64_t key = hashBytes(data, bytes);
+	map<uint64_t, SharedBuffer>::iterator it = sharedBuffers.find(key);
+	if (it != sharedBuffers.end() && it->second.data.size() == bytes && memcmp(&it->second.data[0], data, bytes) == 0)
+		return it->second.BufferID;
+
+	GLuint BufferID;
+	glGenBuffers (1, &BufferID);
+	glBindBuffer (GL_ARRAY_BUFFER, BufferID);
+	glBufferData (GL_ARRAY_BUFFER, bytes, data, GL_STATIC_DRAW);
+	meshStats.buffersCreated++;
+	meshStats.bytesUploaded += bytes;
+
+	// On a hash collision the new buffer is simply not shared
+	if (it == sharedBuffers.end()) {
+		SharedBuffer& shared = sharedBuffers[key];
+		shared.BufferID = BufferID;
+		shared.data.assign((const unsigned char*) data, (const unsigned char*) data + bytes);
+	}
+	return BufferID;
+}
+
+/* Look up a mesh by everything that makes two meshes draw identically */
+struct VAO* findSharedMesh (vector<GLuint>& key, GLenum primitive_mode, int numVertices, GLuint vertexBuffer, GLuint attribBuffer, GLuint textureID, int textureLayer, GLenum fill_mode)
+{
+	meshStats.meshesRequested++;
+	GLuint state[] = { primitive_mode, (GLuint) numVertices, vertexBuffer, attribBuffer, textureID, (GLuint) textureLayer, fill_mode };
+	key.assign(state, state + 7);
+	map<vector<GLuint>, struct VAO*>::iterator it = sharedMeshes.find(key);
+	if (it != sharedMeshes.end())
+		return it->second;
+	meshStats.meshesCreated++;
+	return NULL;
+}
+
+void printMeshRegistryReport ()
+{
+	cout << "Mesh registry: " << meshStats.meshesCreated << "/" << meshStats.meshesRequested << " meshes created, "
+		 << meshStats.buffersCreated << "/" << meshStats.buffersRequested << " buffers created, "
+		 << meshStats.bytesUploaded << "/" << meshStats.bytesRequested << " bytes uploaded" << endl;
+	cout << "Mesh registry saved " << (meshStats.meshesRequested - meshStats.meshesCreated) << " VAOs, "
+		 << (meshStats.buffersRequested - meshStats.buffersCreated) << " VBOs and "
+		 << (meshStats.bytesRequested - meshStats.bytesUploaded) << " bytes" << endl;
+	if (meshStats.meshesPacked > 0)
+		cout << "Packed meshes: " << meshStats.meshesPacked << " meshes, " << meshStats.unpackedBytes << " bytes of float arrays -> "
+			 << meshStats.packedBytes << " bytes of vertices and indices" << endl;
+}
+
+/* Box around numVertices x,y,z positions */
+void meshBounds (int numVertices, const GLfloat* vertex_buffer_data, glm::vec3& lo, glm::vec3& hi)
+{
+	lo = hi = glm::vec3(vertex_buffer_data[0], vertex_buffer_data[1], vertex_buffer_data[2]);
+	for (int i=1; i<numVertices; i++) {
+		glm::vec3 v(vertex_buffer_data[3*i], vertex_buffer_data[3*i + 1], vertex_buffer_data[3*i + 2]);
+		lo = glm::min(lo, v);
+		hi = glm::max(hi, v);
+	}
+}
+
 /* Generate VAO, VBOs and return VAO handle */
 struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloat* vertex_buffer_data, const GLfloat* color_buffer_data, GLenum fill_mode=GL_FILL)
 {
+	GLuint VertexBuffer = acquireSharedBuffer(vertex_buffer_data, 3*numVertices*sizeof(GLfloat)); // VBO - vertices
+	GLuint ColorBuffer = acquireSharedBuffer(color_buffer_data, 3*numVertices*sizeof(GLfloat)); // VBO - colors
+
+	// Identical geometry gets the same VAO handle back
+	vector<GLuint> key;
+	struct VAO* shared = findSharedMesh(key, primitive_mode, numVertices, VertexBuffer, ColorBuffer, 0, 0, fill_mode);
+	if (shared)
+		return shared;
+
 	struct VAO* vao = new struct VAO;
 	vao->PrimitiveMode = primitive_mode;
 	vao->NumVertices = numVertices;
 	vao->FillMode = fill_mode;
+	vao->VertexBuffer = VertexBuffer;
+	vao->ColorBuffer = ColorBuffer;
+	vao->IndexBuffer = 0;
+	vao->TextureID = 0;
+	vao->TextureLayer = 0;
+	meshBounds(numVertices, vertex_buffer_data, vao->BoundsMin, vao->BoundsMax);
 
 	// Create Vertex Array Object
 	// Should be done after CreateWindow and before any other GL calls
 	glGenVertexArrays(1, &(vao->VertexArrayID)); // VAO
-	glGenBuffers (1, &(vao->VertexBuffer)); // VBO - vertices
-	glGenBuffers (1, &(vao->ColorBuffer));  // VBO - colors
-
 	glBindVertexArray (vao->VertexArrayID); // Bind the VAO
+
 	glBindBuffer (GL_ARRAY_BUFFER, vao->VertexBuffer); // Bind the VBO vertices
-	glBufferData (GL_ARRAY_BUFFER, 3*numVertices*sizeof(GLfloat), vertex_buffer_data, GL_STATIC_DRAW); // Copy the vertices into VBO
 	glVertexAttribPointer(
 						  0,                  // attribute 0. Vertices
 						  3,                  // size (x,y,z)
@@ -197,7 +992,6 @@ struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloa
 						  );
 
 	glBindBuffer (GL_ARRAY_BUFFER, vao->ColorBuffer); // Bind the VBO colors
-	glBufferData (GL_ARRAY_BUFFER, 3*numVertices*sizeof(GLfloat), color_buffer_data, GL_STATIC_DRAW);  // Copy the vertex colors
 	glVertexAttribPointer(
 						  1,                  // attribute 1. Color
 						  3,                  // size (r,g,b)
@@ -207,6 +1001,11 @@ struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloa
 						  (void*)0            // array buffer offset
 						  );
 
+	// Enable Vertex Attribute 0 - 3d Vertices and 1 - Color
+	glEnableVertexAttribArray(0);
+	glEnableVertexAttribArray(1);
+
+	sharedMeshes[key] = vao;
 	return vao;
 }
 
@@ -220,26 +1019,58 @@ struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloa
 		color_buffer_data [3*i + 2] = blue;
 	}
 
-	return create3DObject(primitive_mode, numVertices, vertex_buffer_data, color_buffer_data, fill_mode);
+	struct VAO* vao = create3DObject(primitive_mode, numVertices, vertex_buffer_data, color_buffer_data, fill_mode);
+	delete [] color_buffer_data;
+	return vao;
+}
+
+/* Feed attribute 4 - texture array layer - to the bound VAO from a one element buffer.
+ * With a divisor of 1 every vertex of a plain draw reads element 0, and an instanced
+ * draw can rebind the attribute to a per-instance layer instead. */
+void attachTextureLayer (int textureLayer)
+{
+	GLfloat layer = textureLayer;
+	glBindBuffer (GL_ARRAY_BUFFER, acquireSharedBuffer(&layer, sizeof(layer))); // VBO - layer
+	glVertexAttribPointer(
+						  4,                  // attribute 4. Texture layer
+						  1,                  // size (layer)
+						  GL_FLOAT,           // type
+						  GL_FALSE,           // normalized?
+						  0,                  // stride
+						  (void*)0            // array buffer offset
+						  );
+	glVertexAttribDivisor(4, 1);
+	glEnableVertexAttribArray(4);
 }
 
-struct VAO* create3DTexturedObject (GLenum primitive_mode, int numVertices, const GLfloat* vertex_buffer_data, const GLfloat* texture_buffer_data, GLuint textureID, GLenum fill_mode=GL_FILL)
+struct VAO* create3DTexturedObject (GLenum primitive_mode, int numVertices, const GLfloat* vertex_buffer_data, const GLfloat* texture_buffer_data, GLuint textureID, int textureLayer, GLenum fill_mode=GL_FILL)
 {
+	GLuint VertexBuffer = acquireSharedBuffer(vertex_buffer_data, 3*numVertices*sizeof(GLfloat)); // VBO - vertices
+	GLuint TextureBuffer = acquireSharedBuffer(texture_buffer_data, 2*numVertices*sizeof(GLfloat)); // VBO - textures
+
+	// Identical geometry gets the same VAO handle back
+	vector<GLuint> key;
+	struct VAO* shared = findSharedMesh(key, primitive_mode, numVertices, VertexBuffer, TextureBuffer, textureID, textureLayer, fill_mode);
+	if (shared)
+		return shared;
+
 	struct VAO* vao = new struct VAO;
 	vao->PrimitiveMode = primitive_mode;
 	vao->NumVertices = numVertices;
 	vao->FillMode = fill_mode;
 	vao->TextureID = textureID;
+	vao->TextureLayer = textureLayer;
+	vao->VertexBuffer = VertexBuffer;
+	vao->TextureBuffer = TextureBuffer;
+	vao->IndexBuffer = 0;
+	meshBounds(numVertices, vertex_buffer_data, vao->BoundsMin, vao->BoundsMax);
 
 	// Create Vertex Array Object
 	// Should be done after CreateWindow and before any other GL calls
 	glGenVertexArrays(1, &(vao->VertexArrayID)); // VAO
-	glGenBuffers (1, &(vao->VertexBuffer)); // VBO - vertices
-	glGenBuffers (1, &(vao->TextureBuffer));  // VBO - textures
-
 	glBindVertexArray (vao->VertexArrayID); // Bind the VAO
+
 	glBindBuffer (GL_ARRAY_BUFFER, vao->VertexBuffer); // Bind the VBO vertices
-	glBufferData (GL_ARRAY_BUFFER, 3*numVertices*sizeof(GLfloat), vertex_buffer_data, GL_STATIC_DRAW); // Copy the vertices into VBO
 	glVertexAttribPointer(
 						  0,                  // attribute 0. Vertices
 						  3,                  // size (x,y,z)
@@ -250,7 +1081,6 @@ struct VAO* create3DTexturedObject (GLenum primitive_mode, int numVertices, cons
 						  );
 
 	glBindBuffer (GL_ARRAY_BUFFER, vao->TextureBuffer); // Bind the VBO textures
-	glBufferData (GL_ARRAY_BUFFER, 2*numVertices*sizeof(GLfloat), texture_buffer_data, GL_STATIC_DRAW);  // Copy the vertex colors
 	glVertexAttribPointer(
 						  2,                  // attribute 2. Textures
 						  2,                  // size (s,t)
@@ -260,87 +1090,1416 @@ struct VAO* create3DTexturedObject (GLenum primitive_mode, int numVertices, cons
 						  (void*)0            // array buffer offset
 						  );
 
+	// Enable Vertex Attribute 0 - 3d Vertices and 2 - Texture
+	glEnableVertexAttribArray(0);
+	glEnableVertexAttribArray(2);
+	attachTextureLayer(textureLayer);
+
+	sharedMeshes[key] = vao;
 	return vao;
 }
 
-/* Render the VBOs handled by VAO */
-void draw3DObject (struct VAO* vao)
-{
-	// Change the Fill Mode for this object
-	glPolygonMode (GL_FRONT_AND_BACK, vao->FillMode);
-
-	// Bind the VAO to use
-	glBindVertexArray (vao->VertexArrayID);
-
-	// Enable Vertex Attribute 0 - 3d Vertices
-	glEnableVertexAttribArray(0);
-	// Bind the VBO to use
-	glBindBuffer(GL_ARRAY_BUFFER, vao->VertexBuffer);
+/* Compact interleaved vertex : half float position + normalized 16 bit texcoord, 12 bytes */
+struct PackedVertex {
+	GLhalf position[4]; // x, y, z, 1 - w pads the texcoords to a 4 byte boundary
+	GLushort texcoord[2];
+};
 
-	// Enable Vertex Attribute 1 - Color
-	glEnableVertexAttribArray(1);
-	// Bind the VBO to use
-	glBindBuffer(GL_ARRAY_BUFFER, vao->ColorBuffer);
+/* Indexed mesh built from PackedVertex, with corners shared between triangles */
+struct PackedMesh {
+	vector<PackedVertex> vertices;
+	vector<GLubyte> indexData; // raw indices of type indexType
+	GLenum indexType;
+	int numIndices;
+	glm::vec3 boundsMin, boundsMax; // of the float positions, before packing
+};
 
-	// Draw the geometry !
-	glDrawArrays(vao->PrimitiveMode, 0, vao->NumVertices); // Starting from vertex 0; 3 vertices total -> 1 triangle
+/* IEEE 754 binary16 conversion, round to nearest */
+GLhalf toHalf (float f)
+{
+	uint32_t x;
+	memcpy(&x, &f, sizeof(x));
+	uint32_t sign = (x >> 16) & 0x8000;
+	int exponent = (int)((x >> 23) & 0xFF) - 127 + 15;
+	uint32_t mantissa = x & 0x7FFFFF;
+
+	if (exponent <= 0) // too small, flush to signed zero
+		return (GLhalf) sign;
+	if (exponent >= 31) // too large, clamp to infinity
+		return (GLhalf)(sign | 0x7C00);
+	uint32_t h = sign | (exponent << 10) | (mantissa >> 13);
+	if (mantissa & 0x1000) // round, a carry into the exponent is still correct
+		h++;
+	return (GLhalf) h;
 }
 
-void draw3DTexturedObject (struct VAO* vao)
+GLushort toUnorm16 (float f)
 {
-	// Change the Fill Mode for this object
-	glPolygonMode (GL_FRONT_AND_BACK, vao->FillMode);
+	f = f < 0 ? 0 : (f > 1 ? 1 : f);
+	return (GLushort)(f*65535.0f + 0.5f);
+}
 
-	// Bind the VAO to use
-	glBindVertexArray (vao->VertexArrayID);
+/* Convert separate float position/texcoord arrays of non-indexed triangles into a PackedMesh */
+PackedMesh packTexturedMesh (int numVertices, const GLfloat* vertex_buffer_data, const GLfloat* texture_buffer_data)
+{
+	PackedMesh mesh;
+	vector<GLushort> indices;
+	for (int i=0; i<numVertices; i++) {
+		PackedVertex v;
+		for (int c=0; c<3; c++)
+			v.position[c] = toHalf(vertex_buffer_data[3*i + c]);
+		v.position[3] = toHalf(1.0f);
+		v.texcoord[0] = toUnorm16(texture_buffer_data[2*i]);
+		v.texcoord[1] = toUnorm16(texture_buffer_data[2*i + 1]);
+
+		// Share the vertex with an earlier identical corner
+		size_t index = 0;
+		while (index < mesh.vertices.size() && memcmp(&mesh.vertices[index], &v, sizeof(v)) != 0)
+			index++;
+		if (index == mesh.vertices.size())
+			mesh.vertices.push_back(v);
+		indices.push_back((GLushort) index);
+	}
 
-	// Enable Vertex Attribute 0 - 3d Vertices
-	glEnableVertexAttribArray(0);
-	// Bind the VBO to use
-	glBindBuffer(GL_ARRAY_BUFFER, vao->VertexBuffer);
+	mesh.numIndices = numVertices;
+	meshBounds(numVertices, vertex_buffer_data, mesh.boundsMin, mesh.boundsMax);
+	if (mesh.vertices.size() <= 256) {
+		mesh.indexType = GL_UNSIGNED_BYTE;
+		for (size_t i=0; i<indices.size(); i++)
+			mesh.indexData.push_back((GLubyte) indices[i]);
+	}
+	else {
+		mesh.indexType = GL_UNSIGNED_SHORT;
+		mesh.indexData.resize(indices.size()*sizeof(GLushort));
+		memcpy(&mesh.indexData[0], &indices[0], mesh.indexData.size());
+	}
 
-	// Bind Textures using texture units
-	glBindTexture(GL_TEXTURE_2D, vao->TextureID);
+	meshStats.meshesPacked++;
+	meshStats.unpackedBytes += numVertices*5*sizeof(GLfloat);
+	meshStats.packedBytes += mesh.vertices.size()*sizeof(PackedVertex) + mesh.indexData.size();
+	return mesh;
+}
 
-	// Enable Vertex Attribute 2 - Texture
-	glEnableVertexAttribArray(2);
-	// Bind the VBO to use
-	glBindBuffer(GL_ARRAY_BUFFER, vao->TextureBuffer);
+/* Point attributes 0 (position) and 2 (texcoord) of the bound VAO at the PackedVertex buffer
+ * of 'vao', and bind its element buffer */
+void bindPackedVertexAttributes (const struct VAO* vao)
+{
+	glBindBuffer (GL_ARRAY_BUFFER, vao->VertexBuffer); // Bind the VBO vertices
+	glVertexAttribPointer(
+						  0,                                      // attribute 0. Vertices
+						  4,                                      // size (x,y,z,1)
+						  GL_HALF_FLOAT,                          // type
+						  GL_FALSE,                               // normalized?
+						  sizeof(PackedVertex),                   // stride
+						  (void*)offsetof(PackedVertex, position) // array buffer offset
+						  );
+	glVertexAttribPointer(
+						  2,                                      // attribute 2. Textures
+						  2,                                      // size (s,t)
+						  GL_UNSIGNED_SHORT,                      // type
+						  GL_TRUE,                                // normalized?
+						  sizeof(PackedVertex),                   // stride
+						  (void*)offsetof(PackedVertex, texcoord) // array buffer offset
+						  );
+
+	// The element buffer binding is part of the VAO state
+	glBindBuffer (GL_ELEMENT_ARRAY_BUFFER, vao->IndexBuffer);
+
+	// Enable Vertex Attribute 0 - 3d Vertices and 2 - Texture
+	glEnableVertexAttribArray(0);
+	glEnableVertexAttribArray(2);
+}
+
+/* Generate VAO, interleaved VBO and element buffer for a PackedMesh and return VAO handle */
+struct VAO* create3DTexturedObject (GLenum primitive_mode, const PackedMesh& mesh, GLuint textureID, int textureLayer, GLenum fill_mode=GL_FILL)
+{
+	GLuint VertexBuffer = acquireSharedBuffer(&mesh.vertices[0], mesh.vertices.size()*sizeof(PackedVertex)); // VBO - interleaved vertices
+	GLuint IndexBuffer = acquireSharedBuffer(&mesh.indexData[0], mesh.indexData.size()); // VBO - indices
+
+	// Identical geometry gets the same VAO handle back
+	vector<GLuint> key;
+	struct VAO* shared = findSharedMesh(key, primitive_mode, mesh.numIndices, VertexBuffer, IndexBuffer, textureID, textureLayer, fill_mode);
+	if (shared)
+		return shared;
+
+	struct VAO* vao = new struct VAO;
+	vao->PrimitiveMode = primitive_mode;
+	vao->NumVertices = mesh.numIndices;
+	vao->FillMode = fill_mode;
+	vao->TextureID = textureID;
+	vao->TextureLayer = textureLayer;
+	vao->VertexBuffer = VertexBuffer;
+	vao->TextureBuffer = VertexBuffer; // texcoords are interleaved with positions
+	vao->IndexBuffer = IndexBuffer;
+	vao->IndexType = mesh.indexType;
+	vao->BoundsMin = mesh.boundsMin;
+	vao->BoundsMax = mesh.boundsMax;
+
+	// Create Vertex Array Object
+	// Should be done after CreateWindow and before any other GL calls
+	glGenVertexArrays(1, &(vao->VertexArrayID)); // VAO
+	glBindVertexArray (vao->VertexArrayID); // Bind the VAO
+	bindPackedVertexAttributes(vao);
+	attachTextureLayer(textureLayer);
+
+	sharedMeshes[key] = vao;
+	return vao;
+}
+
+/* Shadow copy of the GL binding state, so only real state changes reach the driver */
+struct GLStateCache {
+	GLuint program;
+	GLuint texture;
+	GLuint vertexArray;
+	GLenum fillMode;
+	int requested, issued;         // calls during the current frame
+	int lastRequested, lastIssued; // calls during the previous frame
+	int draws;                     // draw calls during the current frame
+} glState = { ~0u, ~0u, ~0u, ~0u, 0, 0, 0, 0, 0 };
+
+/* Forget the shadowed state, after code outside the cache (setup code) touched GL */
+void invalidateGLState ()
+{
+	glState.program = glState.texture = glState.vertexArray = glState.fillMode = ~0u;
+}
+
+/* Returns true if the call has to be issued, updating the shadow value */
+bool stateChanged (GLuint& shadow, GLuint value)
+{
+	glState.requested++;
+	if (shadow == value)
+		return false;
+	shadow = value;
+	glState.issued++;
+	return true;
+}
+
+void useProgram (GLuint program)
+{
+	if (stateChanged(glState.program, program))
+		glUseProgram (program);
+}
+
+void bindTexture (GLuint texture)
+{
+	if (stateChanged(glState.texture, texture))
+		glBindTexture (GL_TEXTURE_2D_ARRAY, texture);
+}
+
+void bindVertexArray (GLuint vertexArray)
+{
+	if (stateChanged(glState.vertexArray, vertexArray))
+		glBindVertexArray (vertexArray);
+}
+
+void setPolygonMode (GLenum fillMode)
+{
+	if (stateChanged(glState.fillMode, fillMode))
+		glPolygonMode (GL_FRONT_AND_BACK, fillMode);
+}
+
+/* Roll the per-frame counters, call once after every frame */
+void endGLStateFrame ()
+{
+	glState.lastRequested = glState.requested;
+	glState.lastIssued = glState.issued;
+	glState.requested = glState.issued = glState.draws = 0;
+}
+
+/* Frame profiler : named CPU scopes, GL_TIME_ELAPSED queries around the GPU passes,
+ * one CSV row per frame and a rolling min/avg/p99 summary. Off unless --profile is given. */
+enum ProfileScope {
+	PROFILE_INPUT,
+	PROFILE_SIMULATE,
+	PROFILE_GRID,
+	PROFILE_PLAYER,
+	PROFILE_FLUSH,
+	PROFILE_FONT,
+	PROFILE_SWAP,
+	PROFILE_FRAME,
+	PROFILE_SCOPES
+};
+
+enum GpuPass {
+	GPU_SCENE, // the sorted render queue
+	GPU_FONT,
+	GPU_PASSES
+};
+
+const char* profileScopeNames[PROFILE_SCOPES] = {"input", "simulate", "grid", "player", "flush", "font", "swap", "frame"};
+const char* gpuPassNames[GPU_PASSES] = {"gpu_scene", "gpu_font"};
+
+/* Frames kept for the rolling summary */
+const int PROFILE_WINDOW = 600;
+
+struct FrameProfiler {
+	bool enabled;
+	ofstream csv;
+	int frame;
+
+	double scopeStart[PROFILE_SCOPES];
+	double cpuMs[PROFILE_SCOPES];     // this frame, scopes entered twice add up
+	double lastCpuMs[PROFILE_SCOPES]; // previous frame, written out once its GPU times are back
+
+	// Two query sets : frame N writes one while frame N-1's results are read from the other
+	GLuint queries[2][GPU_PASSES];
+	bool queryPending[2][GPU_PASSES];
+	double gpuMs[GPU_PASSES];         // -1 when the result was not ready
+
+	vector<double> history[PROFILE_SCOPES + GPU_PASSES];
+} profiler;
+
+void initProfiler (const char* csvPath)
+{
+	profiler.enabled = true;
+	profiler.frame = 0;
+	glGenQueries(2*GPU_PASSES, &profiler.queries[0][0]);
+	for (int b=0; b<2; b++)
+		for (int p=0; p<GPU_PASSES; p++)
+			profiler.queryPending[b][p] = false;
+	for (int s=0; s<PROFILE_SCOPES; s++)
+		profiler.cpuMs[s] = profiler.lastCpuMs[s] = 0;
+
+	profiler.csv.open(csvPath);
+	if (!profiler.csv.is_open()) {
+		cout << "Could not open profile file " << csvPath << endl;
+		return;
+	}
+	profiler.csv << "frame";
+	for (int s=0; s<PROFILE_SCOPES; s++)
+		profiler.csv << "," << profileScopeNames[s] << "_ms";
+	for (int p=0; p<GPU_PASSES; p++)
+		profiler.csv << "," << gpuPassNames[p] << "_ms";
+	profiler.csv << "\n";
+}
+
+void profileBegin (ProfileScope scope)
+{
+	if (profiler.enabled)
+		profiler.scopeStart[scope] = getTime();
+}
+
+void profileEnd (ProfileScope scope)
+{
+	if (profiler.enabled)
+		profiler.cpuMs[scope] += (getTime() - profiler.scopeStart[scope]) * 1000.0;
+}
+
+/* Timer queries cannot nest, GPU passes must not overlap */
+void gpuPassBegin (GpuPass pass)
+{
+	if (profiler.enabled)
+		glBeginQuery(GL_TIME_ELAPSED, profiler.queries[profiler.frame & 1][pass]);
+}
+
+void gpuPassEnd (GpuPass pass)
+{
+	if (!profiler.enabled)
+		return;
+	glEndQuery(GL_TIME_ELAPSED);
+	profiler.queryPending[profiler.frame & 1][pass] = true;
+}
+
+/* Collect the other query set, issued a frame ago, without waiting on the GPU */
+void readGpuTimes ()
+{
+	int b = (profiler.frame + 1) & 1;
+	for (int p=0; p<GPU_PASSES; p++) {
+		profiler.gpuMs[p] = -1;
+		if (!profiler.queryPending[b][p])
+			continue;
+		GLint available = 0;
+		glGetQueryObjectiv(profiler.queries[b][p], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available)
+			continue; // dropped rather than stalling, shows up as -1 in the CSV
+		GLuint64 ns = 0;
+		glGetQueryObjectui64v(profiler.queries[b][p], GL_QUERY_RESULT, &ns);
+		profiler.gpuMs[p] = ns / 1.0e6;
+		profiler.queryPending[b][p] = false;
+	}
+}
+
+/* Min, average and 99th percentile of the last PROFILE_WINDOW frames */
+void printProfileSummary ()
+{
+	cout << "Frame profile, last " << PROFILE_WINDOW << " frames (ms)        min      avg      p99" << endl;
+	for (int i=0; i<PROFILE_SCOPES + GPU_PASSES; i++) {
+		vector<double> v = profiler.history[i];
+		if (v.empty())
+			continue;
+		sort(v.begin(), v.end());
+		double sum = 0;
+		for (size_t k=0; k<v.size(); k++)
+			sum += v[k];
+		const char* name = i < PROFILE_SCOPES ? profileScopeNames[i] : gpuPassNames[i - PROFILE_SCOPES];
+		char line[128];
+		snprintf(line, sizeof(line), "  %-36s %8.3f %8.3f %8.3f", name, v.front(), sum / v.size(), v[(v.size()*99)/100]);
+		cout << line << endl;
+	}
+	// Redundant state changes the cache kept away from the driver, last frame
+	cout << "GL state: " << glState.lastIssued << " calls issued, "
+		 << (glState.lastRequested - glState.lastIssued) << " redundant calls removed per frame" << endl;
+}
+
+/* Close the frame : record the previous frame now that its GPU times are known */
+void endProfilerFrame ()
+{
+	if (!profiler.enabled)
+		return;
+
+	readGpuTimes();
+	if (profiler.frame > 0) {
+		if (profiler.csv.is_open()) {
+			profiler.csv << profiler.frame - 1;
+			for (int s=0; s<PROFILE_SCOPES; s++)
+				profiler.csv << "," << profiler.lastCpuMs[s];
+			for (int p=0; p<GPU_PASSES; p++)
+				profiler.csv << "," << profiler.gpuMs[p];
+			profiler.csv << "\n";
+		}
+		for (int i=0; i<PROFILE_SCOPES + GPU_PASSES; i++) {
+			double ms = i < PROFILE_SCOPES ? profiler.lastCpuMs[i] : profiler.gpuMs[i - PROFILE_SCOPES];
+			if (ms < 0)
+				continue;
+			vector<double>& h = profiler.history[i];
+			if (h.size() == (size_t) PROFILE_WINDOW)
+				h.erase(h.begin());
+			h.push_back(ms);
+		}
+		if (profiler.frame % PROFILE_WINDOW == 0)
+			printProfileSummary();
+	}
+
+	for (int s=0; s<PROFILE_SCOPES; s++) {
+		profiler.lastCpuMs[s] = profiler.cpuMs[s];
+		profiler.cpuMs[s] = 0;
+	}
+	profiler.frame++;
+}
+
+/* Render the VBOs handled by VAO */
+/* Attribute arrays are enabled once at creation, they are part of the VAO state */
+void draw3DObject (struct VAO* vao)
+{
+	// Change the Fill Mode for this object
+	setPolygonMode (vao->FillMode);
+
+	// Bind the VAO to use
+	bindVertexArray (vao->VertexArrayID);
+
+	// Draw the geometry !
+	glDrawArrays(vao->PrimitiveMode, 0, vao->NumVertices); // Starting from vertex 0; 3 vertices total -> 1 triangle
+	glState.draws++;
+}
+
+void draw3DTexturedObject (struct VAO* vao)
+{
+	// Change the Fill Mode for this object
+	setPolygonMode (vao->FillMode);
+
+	// Bind the VAO to use
+	bindVertexArray (vao->VertexArrayID);
+
+	// Bind Textures using texture units
+	bindTexture (vao->TextureID);
+
+	// Draw the geometry !
+	if (vao->IndexBuffer)
+		glDrawElements(vao->PrimitiveMode, vao->NumVertices, vao->IndexType, (void*)0);
+	else
+		glDrawArrays(vao->PrimitiveMode, 0, vao->NumVertices); // Starting from vertex 0; 3 vertices total -> 1 triangle
+	glState.draws++;
+}
+
+/* One queued draw, executed later in sort key order */
+struct DrawItem {
+	uint64_t key;          // program | texture | VAO | fill mode
+	ShaderProgram* program;
+	struct VAO* vao;
+	int matrixSlot;        // MVP uniform of 'program'
+	glm::mat4 MVP;
+	int instances;         // 0 for a plain glDrawArrays
+};
+
+vector<DrawItem> renderQueue;
+
+bool compareDrawItems (const DrawItem& a, const DrawItem& b)
+{
+	return a.key < b.key;
+}
+
+/* Queue a VAO to be drawn with 'program', the MVP is captured now */
+void submitDraw (ShaderProgram& program, int matrixSlot, struct VAO* vao, const glm::mat4& MVP, int instances=0)
+{
+	DrawItem item;
+	item.key = ((uint64_t)(program.ProgramID & 0xFFFF) << 48) | ((uint64_t)(vao->TextureID & 0xFFFF) << 32)
+			 | ((uint64_t)(vao->VertexArrayID & 0xFFFF) << 16) | (vao->FillMode == GL_FILL ? 0 : 1);
+	item.program = &program;
+	item.vao = vao;
+	item.matrixSlot = matrixSlot;
+	item.MVP = MVP;
+	item.instances = instances;
+	renderQueue.push_back(item);
+}
+
+/* Sort the queued draws to group state changes, then execute them */
+void flushRenderQueue ()
+{
+	// stable_sort keeps submission order between identical keys
+	stable_sort(renderQueue.begin(), renderQueue.end(), compareDrawItems);
+
+	for (size_t i=0; i<renderQueue.size(); i++) {
+		DrawItem& item = renderQueue[i];
+		useProgram(item.program->ProgramID);
+		item.program->setMat4(item.matrixSlot, item.MVP);
+		setPolygonMode(item.vao->FillMode);
+		bindVertexArray(item.vao->VertexArrayID);
+		if (item.vao->TextureID)
+			bindTexture(item.vao->TextureID);
+		struct VAO* vao = item.vao;
+		if (vao->IndexBuffer && item.instances)
+			glDrawElementsInstanced(vao->PrimitiveMode, vao->NumVertices, vao->IndexType, (void*)0, item.instances);
+		else if (vao->IndexBuffer)
+			glDrawElements(vao->PrimitiveMode, vao->NumVertices, vao->IndexType, (void*)0);
+		else if (item.instances)
+			glDrawArraysInstanced(vao->PrimitiveMode, 0, vao->NumVertices, item.instances);
+		else
+			glDrawArrays(vao->PrimitiveMode, 0, vao->NumVertices);
+		glState.draws++;
+	}
+	renderQueue.clear();
+}
+
+/* View frustum culling : boxes outside any of the six planes of Projection * View are not
+ * queued. Planes are kept as (a, b, c, d) with a*x + b*y + c*z + d >= 0 on the inside. */
+struct Frustum {
+	glm::vec4 planes[6];
+};
+
+struct CullStats {
+	long long tilesTested, tilesDrawn;     // board tiles, holes included
+	long long objectsTested, objectsDrawn; // everything else
+} cullStats;
+
+/* Planes of a world to clip space matrix (Gribb and Hartmann) */
+Frustum frustumFromMatrix (const glm::mat4& VP)
+{
+	glm::vec4 row[4];
+	for (int r=0; r<4; r++)
+		row[r] = glm::vec4(VP[0][r], VP[1][r], VP[2][r], VP[3][r]);
+	Frustum f;
+	for (int axis=0; axis<3; axis++) {
+		f.planes[2*axis] = row[3] + row[axis];
+		f.planes[2*axis + 1] = row[3] - row[axis];
+	}
+	return f;
+}
+
+/* Distance of the box corner furthest along the plane normal, negative if the whole box is outside */
+float planeReach (const glm::vec4& plane, const glm::vec3& center, const glm::vec3& extent)
+{
+	return plane.x*center.x + plane.y*center.y + plane.z*center.z + plane.w
+		 + fabsf(plane.x)*extent.x + fabsf(plane.y)*extent.y + fabsf(plane.z)*extent.z;
+}
+
+/* World space box around a mesh's model space box, transformed by 'model' */
+void transformBounds (const glm::mat4& model, const glm::vec3& lo, const glm::vec3& hi, glm::vec3& center, glm::vec3& extent)
+{
+	glm::vec3 c = (lo + hi) * 0.5f, e = (hi - lo) * 0.5f;
+	center = glm::vec3(model * glm::vec4(c, 1));
+	for (int r=0; r<3; r++)
+		extent[r] = fabsf(model[0][r])*e.x + fabsf(model[1][r])*e.y + fabsf(model[2][r])*e.z;
+}
+
+/* True unless the mesh drawn with 'model' is entirely outside the frustum */
+bool objectVisible (const Frustum& f, const struct VAO* vao, const glm::mat4& model)
+{
+	glm::vec3 center, extent;
+	transformBounds(model, vao->BoundsMin, vao->BoundsMax, center, extent);
+	cullStats.objectsTested++;
+	for (int p=0; p<6; p++)
+		if (planeReach(f.planes[p], center, extent) < 0)
+			return false;
+	cullStats.objectsDrawn++;
+	return true;
+}
+
+/* Texture cooker : images are decoded, resampled to the layer size and their mip chain
+ * built once, then kept in texture_cache/<name>.tex. Later launches read that file in one
+ * go and upload it level by level, with no image decode and no glGenerateMipmap. */
+const char* TEXTURE_CACHE_DIR = "texture_cache";
+
+struct CookedTextureHeader {
+	char magic[4];          // "CTEX"
+	uint32_t version;
+	uint32_t width, height;
+	uint32_t levels;
+	GLenum internalFormat;  // sized format for glTexStorage2D
+	GLenum format, type;    // client format of the stored texels
+	uint64_t sourceSize;    // source file size and modification time, to notice edits
+	uint64_t sourceTime;
+	uint64_t contentHash;   // hash of all the texel data that follows the level table
+};
+
+const uint32_t COOKED_TEXTURE_VERSION = 2;
+
+struct CookedMipLevel {
+	uint32_t width, height;
+	uint32_t offset, size; // bytes, from the start of the texel data
+};
+
+/* A cooked texture in memory, exactly as it is stored on disk */
+struct CookedTexture {
+	vector<unsigned char> file;
+
+	const CookedTextureHeader& header () const { return *(const CookedTextureHeader*) &file[0]; }
+	const CookedMipLevel& level (int i) const { return ((const CookedMipLevel*) &file[sizeof(CookedTextureHeader)])[i]; }
+	const unsigned char* texels () const { return &file[sizeof(CookedTextureHeader) + header().levels*sizeof(CookedMipLevel)]; }
+};
+
+struct TextureStartupStats {
+	int textures, cooked;
+	size_t bytesRead;
+	size_t vramBytes, uncompressedBytes;
+	double ms;
+} textureStats;
+
+/* texture_cache/<name><extension>, for everything baked from an asset file */
+string cachePath (const char* filename, const char* extension)
+{
+	string name = filename;
+	size_t slash = name.find_last_of('/');
+	if (slash != string::npos)
+		name = name.substr(slash + 1);
+	return string(TEXTURE_CACHE_DIR) + "/" + name + extension;
+}
+
+/* Next mip level of an RGB image, a 2x2 box filter that clamps at odd edges */
+void downsampleRGB (const unsigned char* src, int w, int h, unsigned char* dst, int dw, int dh)
+{
+	for (int y=0; y<dh; y++)
+		for (int x=0; x<dw; x++) {
+			int x0 = min(2*x, w-1), x1 = min(2*x+1, w-1);
+			int y0 = min(2*y, h-1), y1 = min(2*y+1, h-1);
+			for (int c=0; c<3; c++) {
+				int sum = src[(y0*w+x0)*3+c] + src[(y0*w+x1)*3+c] + src[(y1*w+x0)*3+c] + src[(y1*w+x1)*3+c];
+				dst[(y*dw+x)*3+c] = (unsigned char) ((sum + 2) / 4);
+			}
+		}
+}
+
+/* Bilinear resample, used to bring every image to the common size of the texture array */
+void resampleRGB (const unsigned char* src, int w, int h, unsigned char* dst, int dw, int dh)
+{
+	for (int y=0; y<dh; y++) {
+		float sy = max(0.0f, (y + 0.5f) * h / dh - 0.5f);
+		int y0 = min((int) sy, h-1), y1 = min(y0+1, h-1);
+		float fy = sy - y0;
+		for (int x=0; x<dw; x++) {
+			float sx = max(0.0f, (x + 0.5f) * w / dw - 0.5f);
+			int x0 = min((int) sx, w-1), x1 = min(x0+1, w-1);
+			float fx = sx - x0;
+			for (int c=0; c<3; c++) {
+				float top = src[(y0*w+x0)*3+c] * (1-fx) + src[(y0*w+x1)*3+c] * fx;
+				float bottom = src[(y1*w+x0)*3+c] * (1-fx) + src[(y1*w+x1)*3+c] * fx;
+				dst[(y*dw+x)*3+c] = (unsigned char) (top * (1-fy) + bottom * fy + 0.5f);
+			}
+		}
+	}
+}
+
+/* Block compression : textures are stored as BC1 (S3TC DXT1) where the driver has it,
+ * else as ETC2 RGB8, else uncompressed. Both use 8 bytes per 4x4 block, 4 bits per texel. */
+enum TextureEncoding {
+	TEXTURE_AUTO,
+	TEXTURE_RGB,
+	TEXTURE_BC1,
+	TEXTURE_ETC2
+};
+
+TextureEncoding textureEncoding = TEXTURE_AUTO; // --texture-format overrides the choice
+
+GLenum encodingFormat (TextureEncoding encoding)
+{
+	if (encoding == TEXTURE_BC1)
+		return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+	if (encoding == TEXTURE_ETC2)
+		return GL_COMPRESSED_RGB8_ETC2;
+	return GL_RGB8;
+}
+
+bool encodingSupported (TextureEncoding encoding)
+{
+	if (encoding == TEXTURE_BC1)
+		return GLAD_GL_EXT_texture_compression_s3tc;
+	if (encoding == TEXTURE_ETC2)
+		return GLAD_GL_VERSION_4_3 || GLAD_GL_ARB_ES3_compatibility;
+	return true;
+}
+
+/* Encoding used for textures cooked on this driver. initGL settles it into textureEncoding
+ * before the asset loader starts, so the workers never print the message below. */
+TextureEncoding chooseTextureEncoding ()
+{
+	if (textureEncoding != TEXTURE_AUTO && encodingSupported(textureEncoding))
+		return textureEncoding;
+	if (textureEncoding != TEXTURE_AUTO)
+		cout << "Requested texture format is not supported, choosing another" << endl;
+	if (encodingSupported(TEXTURE_BC1))
+		return TEXTURE_BC1;
+	if (encodingSupported(TEXTURE_ETC2))
+		return TEXTURE_ETC2;
+	return TEXTURE_RGB;
+}
+
+/* Copy the 4x4 block at (bx,by), repeating edge texels of levels smaller than a block */
+void fetchBlock (const unsigned char* src, int w, int h, int bx, int by, int block[16][3])
+{
+	for (int y=0; y<4; y++)
+		for (int x=0; x<4; x++) {
+			const unsigned char* p = src + (min(by+y, h-1)*w + min(bx+x, w-1))*3;
+			for (int c=0; c<3; c++)
+				block[y*4+x][c] = p[c];
+		}
+}
+
+uint16_t packRGB565 (const int c[3])
+{
+	return (uint16_t) (((c[0]*31 + 127)/255) << 11 | ((c[1]*63 + 127)/255) << 5 | ((c[2]*31 + 127)/255));
+}
+
+void unpackRGB565 (uint16_t v, int c[3])
+{
+	int r = (v >> 11) & 31, g = (v >> 5) & 63, b = v & 31;
+	c[0] = (r << 3) | (r >> 2);
+	c[1] = (g << 2) | (g >> 4);
+	c[2] = (b << 3) | (b >> 2);
+}
+
+int colorDistance (const int a[3], const int b[3])
+{
+	int dr = a[0]-b[0], dg = a[1]-b[1], db = a[2]-b[2];
+	return dr*dr + dg*dg + db*db;
+}
+
+/* BC1 block : endpoints are the texels furthest apart along the block's main colour axis */
+void encodeBC1Block (int block[16][3], unsigned char* out)
+{
+	float mean[3] = {0, 0, 0};
+	for (int i=0; i<16; i++)
+		for (int c=0; c<3; c++)
+			mean[c] += block[i][c] / 16.0f;
+
+	// Main axis by a few power iterations on the covariance matrix
+	float cov[6] = {0, 0, 0, 0, 0, 0};
+	for (int i=0; i<16; i++) {
+		float d[3] = { block[i][0]-mean[0], block[i][1]-mean[1], block[i][2]-mean[2] };
+		cov[0] += d[0]*d[0]; cov[1] += d[0]*d[1]; cov[2] += d[0]*d[2];
+		cov[3] += d[1]*d[1]; cov[4] += d[1]*d[2]; cov[5] += d[2]*d[2];
+	}
+	float axis[3] = {1, 1, 1};
+	for (int k=0; k<4; k++) {
+		float x = cov[0]*axis[0] + cov[1]*axis[1] + cov[2]*axis[2];
+		float y = cov[1]*axis[0] + cov[3]*axis[1] + cov[4]*axis[2];
+		float z = cov[2]*axis[0] + cov[4]*axis[1] + cov[5]*axis[2];
+		float len = max(max(fabsf(x), fabsf(y)), fabsf(z));
+		if (len == 0)
+			break;
+		axis[0] = x/len; axis[1] = y/len; axis[2] = z/len;
+	}
+
+	int lo = 0, hi = 0;
+	float loDot = 1e30f, hiDot = -1e30f;
+	for (int i=0; i<16; i++) {
+		float d = block[i][0]*axis[0] + block[i][1]*axis[1] + block[i][2]*axis[2];
+		if (d < loDot) { loDot = d; lo = i; }
+		if (d > hiDot) { hiDot = d; hi = i; }
+	}
+
+	uint16_t c0 = packRGB565(block[hi]), c1 = packRGB565(block[lo]);
+	if (c0 < c1)
+		swap(c0, c1); // c0 > c1 selects the four colour mode
+	int palette[4][3];
+	unpackRGB565(c0, palette[0]);
+	unpackRGB565(c1, palette[1]);
+	for (int c=0; c<3; c++) {
+		palette[2][c] = (2*palette[0][c] + palette[1][c]) / 3;
+		palette[3][c] = (palette[0][c] + 2*palette[1][c]) / 3;
+	}
+
+	uint32_t indices = 0;
+	if (c0 != c1) // equal endpoints leave every index at 0
+		for (int i=0; i<16; i++) {
+			int best = 0;
+			for (int p=1; p<4; p++)
+				if (colorDistance(block[i], palette[p]) < colorDistance(block[i], palette[best]))
+					best = p;
+			indices |= (uint32_t) best << (2*i);
+		}
+
+	out[0] = c0 & 0xFF; out[1] = c0 >> 8;
+	out[2] = c1 & 0xFF; out[3] = c1 >> 8;
+	for (int k=0; k<4; k++)
+		out[4+k] = (indices >> (8*k)) & 0xFF;
+}
+
+/* ETC1 intensity modifier tables, ETC1 blocks are valid ETC2 RGB8 blocks */
+const int etcModifiers[8][2] = { {2,8}, {5,17}, {9,29}, {13,42}, {18,60}, {24,80}, {33,106}, {47,183} };
+
+/* Best 4 bit base colour and table for the 8 texels of one half block, returns the error */
+int encodeETCHalf (int block[16][3], const int texels[8], int base[3], int& table, int selectors[16])
+{
+	for (int c=0; c<3; c++) {
+		int sum = 0;
+		for (int i=0; i<8; i++)
+			sum += block[texels[i]][c];
+		int q = (sum*15 + 8*255/2) / (8*255);
+		base[c] = q;
+	}
+	int color[3] = { base[0]*17, base[1]*17, base[2]*17 };
+
+	int bestError = INT_MAX;
+	for (int t=0; t<8; t++) {
+		int error = 0, chosen[8];
+		for (int i=0; i<8; i++) {
+			int bestTexel = INT_MAX;
+			for (int s=0; s<4; s++) {
+				// selector 0 : +a, 1 : +b, 2 : -a, 3 : -b
+				int m = (s & 2) ? -etcModifiers[t][s & 1] : etcModifiers[t][s & 1];
+				int candidate[3];
+				for (int c=0; c<3; c++)
+					candidate[c] = min(255, max(0, color[c] + m));
+				int e = colorDistance(block[texels[i]], candidate);
+				if (e < bestTexel) {
+					bestTexel = e;
+					chosen[i] = s;
+				}
+			}
+			error += bestTexel;
+		}
+		if (error < bestError) {
+			bestError = error;
+			table = t;
+			for (int i=0; i<8; i++)
+				selectors[texels[i]] = chosen[i];
+		}
+	}
+	return bestError;
+}
+
+/* ETC1 individual mode block, trying both the side by side and the stacked split */
+void encodeETCBlock (int block[16][3], unsigned char* out)
+{
+	uint64_t bestBits = 0;
+	int bestError = INT_MAX;
+	for (int flip=0; flip<2; flip++) {
+		int halves[2][8], n[2] = {0, 0};
+		for (int y=0; y<4; y++)
+			for (int x=0; x<4; x++) {
+				int h = flip ? (y >= 2) : (x >= 2);
+				halves[h][n[h]++] = y*4 + x;
+			}
+		int base[2][3], table[2], selectors[16];
+		int error = encodeETCHalf(block, halves[0], base[0], table[0], selectors)
+				  + encodeETCHalf(block, halves[1], base[1], table[1], selectors);
+		if (error >= bestError)
+			continue;
+		bestError = error;
+
+		uint64_t bits = 0;
+		bits |= (uint64_t) base[0][0] << 60 | (uint64_t) base[1][0] << 56;
+		bits |= (uint64_t) base[0][1] << 52 | (uint64_t) base[1][1] << 48;
+		bits |= (uint64_t) base[0][2] << 44 | (uint64_t) base[1][2] << 40;
+		bits |= (uint64_t) table[0] << 37 | (uint64_t) table[1] << 34;
+		bits |= (uint64_t) flip << 32; // diff bit 33 stays 0 : individual mode
+		for (int y=0; y<4; y++)
+			for (int x=0; x<4; x++) {
+				int s = selectors[y*4 + x], bit = x*4 + y; // texels are numbered down the columns
+				bits |= (uint64_t) (s >> 1) << (16 + bit);
+				bits |= (uint64_t) (s & 1) << bit;
+			}
+		bestBits = bits;
+	}
+	for (int k=0; k<8; k++)
+		out[k] = (bestBits >> (56 - 8*k)) & 0xFF; // stored big endian
+}
+
+/* Bytes of one level in the given encoding */
+uint32_t encodedLevelSize (TextureEncoding encoding, int w, int h)
+{
+	if (encoding == TEXTURE_RGB)
+		return w*h*3;
+	return ((w+3)/4) * ((h+3)/4) * 8;
+}
+
+/* Compress one RGB level into 4x4 blocks, stored row by row */
+void encodeLevel (TextureEncoding encoding, const unsigned char* src, int w, int h, unsigned char* out)
+{
+	int block[16][3];
+	for (int by=0; by<h; by+=4)
+		for (int bx=0; bx<w; bx+=4) {
+			fetchBlock(src, w, h, bx, by, block);
+			if (encoding == TEXTURE_BC1)
+				encodeBC1Block(block, out);
+			else
+				encodeETCBlock(block, out);
+			out += 8;
+		}
+}
+
+/* Decode the image, resample it to layerSize x layerSize, build its full mip chain, encode it
+ * and write the container */
+bool cookTexture (const char* filename, const struct stat& source, TextureEncoding encoding, int layerSize, CookedTexture& cooked)
+{
+	const unsigned char* data;
+	size_t size;
+	vector<unsigned char> storage;
+	if (!readAssetFile(filename, data, size, storage))
+		return false;
+	int imageWidth, imageHeight;
+	unsigned char* image = SOIL_load_image_from_memory(data, size, &imageWidth, &imageHeight, 0, SOIL_LOAD_RGB);
+	if (!image)
+		return false;
+
+	// RGB mip chain first, every level is built from the uncompressed level above
+	int width = layerSize, height = layerSize;
+	vector< vector<unsigned char> > rgbLevels(1, vector<unsigned char>(width*height*3));
+	resampleRGB(image, imageWidth, imageHeight, &rgbLevels[0][0], width, height);
+	SOIL_free_image_data(image);
+	vector<CookedMipLevel> levels;
+	uint32_t offset = 0;
+	for (int w=width, h=height; ; w=max(1, w/2), h=max(1, h/2)) {
+		if (!levels.empty()) {
+			const CookedMipLevel& above = levels.back();
+			rgbLevels.push_back(vector<unsigned char>(w*h*3));
+			downsampleRGB(&rgbLevels[rgbLevels.size()-2][0], above.width, above.height, &rgbLevels.back()[0], w, h);
+		}
+		CookedMipLevel level = { (uint32_t) w, (uint32_t) h, offset, encodedLevelSize(encoding, w, h) };
+		levels.push_back(level);
+		offset += level.size;
+		if (w == 1 && h == 1)
+			break;
+	}
+
+	size_t texelStart = sizeof(CookedTextureHeader) + levels.size()*sizeof(CookedMipLevel);
+	cooked.file.assign(texelStart + offset, 0);
+	unsigned char* texels = &cooked.file[texelStart];
+	for (size_t i=0; i<levels.size(); i++) {
+		if (encoding == TEXTURE_RGB)
+			memcpy(texels + levels[i].offset, &rgbLevels[i][0], levels[i].size);
+		else
+			encodeLevel(encoding, &rgbLevels[i][0], levels[i].width, levels[i].height, texels + levels[i].offset);
+	}
+
+	CookedTextureHeader header;
+	memcpy(header.magic, "CTEX", 4);
+	header.version = COOKED_TEXTURE_VERSION;
+	header.width = width;
+	header.height = height;
+	header.levels = levels.size();
+	header.internalFormat = encodingFormat(encoding);
+	header.format = encoding == TEXTURE_RGB ? GL_RGB : 0; // 0 for block compressed data
+	header.type = encoding == TEXTURE_RGB ? GL_UNSIGNED_BYTE : 0;
+	header.sourceSize = source.st_size;
+	header.sourceTime = source.st_mtime;
+	header.contentHash = hashBytes(texels, offset);
+	memcpy(&cooked.file[0], &header, sizeof(header));
+	memcpy(&cooked.file[sizeof(header)], &levels[0], levels.size()*sizeof(CookedMipLevel));
+
+	mkdir(TEXTURE_CACHE_DIR, 0755);
+	ofstream out(cachePath(filename, ".tex").c_str(), ios::binary);
+	out.write((const char*) &cooked.file[0], cooked.file.size());
+	return true;
+}
+
+/* Read the whole cooked file, false if it is missing, damaged, older than its source
+ * or stored in another encoding or size */
+bool readCookedTexture (const char* filename, const struct stat& source, TextureEncoding encoding, int layerSize, CookedTexture& cooked)
+{
+	ifstream in(cachePath(filename, ".tex").c_str(), ios::binary | ios::ate);
+	if (!in.is_open())
+		return false;
+	size_t size = in.tellg();
+	if (size < sizeof(CookedTextureHeader))
+		return false;
+	cooked.file.resize(size);
+	in.seekg(0);
+	if (!in.read((char*) &cooked.file[0], size))
+		return false;
+
+	const CookedTextureHeader& header = cooked.header();
+	if (memcmp(header.magic, "CTEX", 4) != 0 || header.version != COOKED_TEXTURE_VERSION ||
+		header.sourceSize != (uint64_t) source.st_size || header.sourceTime != (uint64_t) source.st_mtime ||
+		header.internalFormat != encodingFormat(encoding) || header.width != (uint32_t) layerSize || header.height != (uint32_t) layerSize)
+		return false;
+	size_t texelStart = sizeof(CookedTextureHeader) + header.levels*sizeof(CookedMipLevel);
+	if (header.levels == 0 || size < texelStart)
+		return false;
+	const CookedMipLevel& last = cooked.level(header.levels - 1);
+	if (texelStart + last.offset + last.size > size)
+		return false;
+	// Catches texels damaged on disk, which the sizes above cannot
+	return hashBytes(cooked.texels(), last.offset + last.size) == header.contentHash;
+}
+
+/* Cooked layerSize x layerSize texture for an image file, cooking it first when needed.
+ * Touches no GL state, so the asset loader runs it on its worker threads. */
+bool loadCookedTexture (const char* filename, int layerSize, CookedTexture& cooked, bool& cookedNow)
+{
+	cookedNow = false;
+	struct stat source;
+	if (!statAssetFile(filename, source))
+		return false;
+	TextureEncoding encoding = chooseTextureEncoding();
+	if (readCookedTexture(filename, source, encoding, layerSize, cooked))
+		return true;
+	cookedNow = true;
+	return cookTexture(filename, source, encoding, layerSize, cooked);
+}
+
+/* Allocate the full mip chain of a 'layers' deep array of layerSize x layerSize textures in
+ * 'encoding', immutable where supported, so layers can be uploaded in any order later */
+void allocateTextureArray (TextureEncoding encoding, int layerSize, int layers)
+{
+	int levels = 1;
+	while ((layerSize >> (levels-1)) > 1)
+		levels++;
+	GLenum internalFormat = encodingFormat(encoding);
+	if (GLAD_GL_ARB_texture_storage || GLAD_GL_VERSION_4_2) {
+		glTexStorage3D(GL_TEXTURE_2D_ARRAY, levels, internalFormat, layerSize, layerSize, layers);
+		return;
+	}
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, levels - 1);
+	for (int i=0; i<levels; i++) {
+		int size = max(1, layerSize >> i);
+		if (encoding == TEXTURE_RGB)
+			glTexImage3D(GL_TEXTURE_2D_ARRAY, i, internalFormat, size, size, layers, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+		else
+			glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, i, internalFormat, size, size, layers, 0, encodedLevelSize(encoding, size, size)*layers, NULL);
+	}
+}
+
+/* Staging buffer for texture uploads, orphaned for every layer so an upload never
+ * waits for the GPU to finish reading the previous one */
+GLuint textureUploadBuffer = 0;
+
+/* Upload every stored level into one layer of the bound texture array. The texels are
+ * copied into a pixel buffer object and the driver transfers them from there. */
+void uploadCookedLayer (const CookedTexture& cooked, int layer)
+{
+	const CookedTextureHeader& header = cooked.header();
+	bool compressed = header.format == 0;
+	const CookedMipLevel& last = cooked.level(header.levels - 1);
+	size_t bytes = last.offset + last.size;
+
+	if (!textureUploadBuffer)
+		glGenBuffers(1, &textureUploadBuffer);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, textureUploadBuffer);
+	glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, NULL, GL_STREAM_DRAW);
+	void* staging = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	if (staging) {
+		memcpy(staging, cooked.texels(), bytes);
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+	}
+	else
+		glBufferSubData(GL_PIXEL_UNPACK_BUFFER, 0, bytes, cooked.texels());
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1); // odd sized RGB levels are not 4 byte aligned
+	for (uint32_t i=0; i<header.levels; i++) {
+		const CookedMipLevel& level = cooked.level(i);
+		const void* data = (const void*)(uintptr_t) level.offset; // offset into the bound buffer
+		if (compressed)
+			glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, i, 0, 0, layer, level.width, level.height, 1, header.internalFormat, level.size, data);
+		else
+			glTexSubImage3D(GL_TEXTURE_2D_ARRAY, i, 0, 0, layer, level.width, level.height, 1, header.format, header.type, data);
+	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	// Drivers pad GL_RGB8 to 4 bytes per texel, compare against that
+	for (uint32_t i=0; i<header.levels; i++) {
+		const CookedMipLevel& level = cooked.level(i);
+		textureStats.vramBytes += compressed ? level.size : level.width*level.height*4;
+		textureStats.uncompressedBytes += level.width*level.height*4;
+	}
+}
+
+void printTextureStartupReport ()
+{
+	char line[160];
+	snprintf(line, sizeof(line), "Textures: %d loaded, %d cooked this launch, %.1f KB of cooked data, %.1f ms",
+			 textureStats.textures, textureStats.cooked, textureStats.bytesRead / 1024.0, textureStats.ms);
+	cout << line << endl;
+	const char* names[] = { "auto", "RGB8", "BC1", "ETC2 RGB8" };
+	snprintf(line, sizeof(line), "Texture VRAM: %.1f KB as %s, %.1f KB uncompressed (%.1fx smaller)",
+			 textureStats.vramBytes / 1024.0, names[chooseTextureEncoding()], textureStats.uncompressedBytes / 1024.0,
+			 (double) textureStats.uncompressedBytes / max((size_t) 1, textureStats.vramBytes));
+	cout << line << endl;
+}
+
+/* Every textured mesh samples the same array, so a frame binds one texture.
+ * Images are resampled to this size when cooked, whatever their original size. */
+const int TEXTURE_LAYER_SIZE = 512;
+
+/* Create an OpenGL texture array of 'layers' empty layers, the asset loader fills them in */
+GLuint createTextureArray (int layers)
+{
+	GLuint TextureID;
+	// Generate Texture Buffer
+	glGenTextures(1, &TextureID);
+	// All upcoming GL_TEXTURE_2D_ARRAY operations now have effect on our texture buffer
+	glBindTexture(GL_TEXTURE_2D_ARRAY, TextureID);
+	// Set our texture parameters
+	// Set texture wrapping to GL_REPEAT
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	// Set texture filtering (interpolation)
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+	// Every layer is cooked to the same size and encoding, so storage does not wait for the images
+	allocateTextureArray(chooseTextureEncoding(), TEXTURE_LAYER_SIZE, layers);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0); // Unbind texture when done, so we won't accidentily mess it up
+
+	return TextureID;
+}
+
+
+/* Glyph atlas : the printable ASCII glyphs of the HUD font are rasterised by FreeType once,
+ * shelf packed into one single channel image and kept in texture_cache/<font>.atlas with
+ * their metrics. Later launches read that file and never open FreeType. */
+const int GLYPH_PIXEL_SIZE = 32;  // em size the glyphs are rasterised at
+const int GLYPH_ATLAS_WIDTH = 512;
+const int GLYPH_FIRST = 32;       // ' '
+const int GLYPH_COUNT = 95;       // ' ' to '~'
+
+struct GlyphAtlasHeader {
+	char magic[4];          // "GATL"
+	uint32_t version;
+	uint32_t pixelSize;
+	uint32_t width, height;
+	uint32_t firstGlyph, glyphs;
+	uint64_t sourceSize;    // font file size and modification time, to notice edits
+	uint64_t sourceTime;
+};
+
+const uint32_t GLYPH_ATLAS_VERSION = 1;
+
+/* Pixels, from the pen position on the baseline, y up */
+struct GlyphInfo {
+	uint16_t x, y;          // top left corner in the atlas
+	uint16_t width, height;
+	int16_t left, top;      // bitmap offset from the pen
+	float advance;
+};
+
+/* A glyph atlas in memory, exactly as it is stored on disk */
+struct GlyphAtlas {
+	vector<unsigned char> file;
+
+	const GlyphAtlasHeader& header () const { return *(const GlyphAtlasHeader*) &file[0]; }
+	const GlyphInfo& glyph (int i) const { return ((const GlyphInfo*) &file[sizeof(GlyphAtlasHeader)])[i]; }
+	const unsigned char* pixels () const { return &file[sizeof(GlyphAtlasHeader) + header().glyphs*sizeof(GlyphInfo)]; }
+};
+
+/* Rasterise the glyphs of a font file and write the atlas to the cache */
+bool bakeGlyphAtlas (const char* filename, const struct stat& source, int pixelSize, GlyphAtlas& atlas)
+{
+	const unsigned char* data;
+	size_t size;
+	vector<unsigned char> storage;
+	if (!readAssetFile(filename, data, size, storage))
+		return false;
+	FT_Library library;
+	if (FT_Init_FreeType(&library))
+		return false;
+	FT_Face face;
+	if (FT_New_Memory_Face(library, data, size, 0, &face)) {
+		FT_Done_FreeType(library);
+		return false;
+	}
+	FT_Set_Pixel_Sizes(face, 0, pixelSize);
+
+	// Shelves of glyphs, a new shelf when the row is full, 1 pixel of padding around each
+	vector<GlyphInfo> glyphs(GLYPH_COUNT);
+	vector<unsigned char> pixels(GLYPH_ATLAS_WIDTH*GLYPH_ATLAS_WIDTH, 0);
+	int x = 1, y = 1, shelfHeight = 0;
+	bool ok = true;
+	for (int i=0; i<GLYPH_COUNT && ok; i++) {
+		GlyphInfo& glyph = glyphs[i];
+		memset(&glyph, 0, sizeof(glyph));
+		if (FT_Load_Char(face, GLYPH_FIRST + i, FT_LOAD_RENDER))
+			continue; // missing glyphs draw nothing
+		const FT_Bitmap& bitmap = face->glyph->bitmap;
+		int w = bitmap.width, h = bitmap.rows;
+		if (x + w + 1 > GLYPH_ATLAS_WIDTH) {
+			x = 1;
+			y += shelfHeight + 1;
+			shelfHeight = 0;
+		}
+		if (y + h + 1 > GLYPH_ATLAS_WIDTH) {
+			ok = false;
+			break;
+		}
+		for (int row=0; row<h; row++)
+			memcpy(&pixels[(y + row)*GLYPH_ATLAS_WIDTH + x], bitmap.buffer + row*bitmap.pitch, w);
+		glyph.x = x;
+		glyph.y = y;
+		glyph.width = w;
+		glyph.height = h;
+		glyph.left = face->glyph->bitmap_left;
+		glyph.top = face->glyph->bitmap_top;
+		glyph.advance = face->glyph->advance.x / 64.0f;
+		x += w + 1;
+		shelfHeight = max(shelfHeight, h);
+	}
+	FT_Done_Face(face);
+	FT_Done_FreeType(library);
+	if (!ok)
+		return false;
+
+	// Only the rows in use are kept, rounded up to a power of two
+	int height = 1;
+	while (height < y + shelfHeight + 1)
+		height *= 2;
+
+	GlyphAtlasHeader header;
+	memcpy(header.magic, "GATL", 4);
+	header.version = GLYPH_ATLAS_VERSION;
+	header.pixelSize = pixelSize;
+	header.width = GLYPH_ATLAS_WIDTH;
+	header.height = height;
+	header.firstGlyph = GLYPH_FIRST;
+	header.glyphs = GLYPH_COUNT;
+	header.sourceSize = source.st_size;
+	header.sourceTime = source.st_mtime;
+	size_t pixelStart = sizeof(header) + GLYPH_COUNT*sizeof(GlyphInfo);
+	atlas.file.resize(pixelStart + GLYPH_ATLAS_WIDTH*height);
+	memcpy(&atlas.file[0], &header, sizeof(header));
+	memcpy(&atlas.file[sizeof(header)], &glyphs[0], GLYPH_COUNT*sizeof(GlyphInfo));
+	memcpy(&atlas.file[pixelStart], &pixels[0], GLYPH_ATLAS_WIDTH*height);
+
+	mkdir(TEXTURE_CACHE_DIR, 0755);
+	ofstream out(cachePath(filename, ".atlas").c_str(), ios::binary);
+	out.write((const char*) &atlas.file[0], atlas.file.size());
+	return true;
+}
+
+/* Read the cached atlas, false if it is missing, damaged, older than the font or baked at another size */
+bool readGlyphAtlas (const char* filename, const struct stat& source, int pixelSize, GlyphAtlas& atlas)
+{
+	ifstream in(cachePath(filename, ".atlas").c_str(), ios::binary | ios::ate);
+	if (!in.is_open())
+		return false;
+	size_t size = in.tellg();
+	if (size < sizeof(GlyphAtlasHeader))
+		return false;
+	atlas.file.resize(size);
+	in.seekg(0);
+	if (!in.read((char*) &atlas.file[0], size))
+		return false;
+
+	const GlyphAtlasHeader& header = atlas.header();
+	if (memcmp(header.magic, "GATL", 4) != 0 || header.version != GLYPH_ATLAS_VERSION ||
+		header.sourceSize != (uint64_t) source.st_size || header.sourceTime != (uint64_t) source.st_mtime ||
+		header.pixelSize != (uint32_t) pixelSize || header.firstGlyph != GLYPH_FIRST || header.glyphs != GLYPH_COUNT)
+		return false;
+	return size == sizeof(GlyphAtlasHeader) + header.glyphs*sizeof(GlyphInfo) + header.width*header.height;
+}
+
+/* Glyph atlas of a font file, baking it first when needed. Touches no GL state. */
+bool loadGlyphAtlas (const char* filename, int pixelSize, GlyphAtlas& atlas, bool& bakedNow)
+{
+	bakedNow = false;
+	struct stat source;
+	if (!statAssetFile(filename, source))
+		return false;
+	if (readGlyphAtlas(filename, source, pixelSize, atlas))
+		return true;
+	bakedNow = true;
+	return bakeGlyphAtlas(filename, source, pixelSize, atlas);
+}
+
+/* HUD text : each element (lives, level) is laid out into textured quads only when the value
+ * it shows changes. All elements share one vertex buffer, re-uploaded on those changes and
+ * drawn with a single call, so a frame with nothing new does no layout and no upload. */
+const int HUD_TEXTURE_UNIT = 1; // the atlas stays bound here, unit 0 belongs to the texture array
 
-	// Draw the geometry !
-	glDrawArrays(vao->PrimitiveMode, 0, vao->NumVertices); // Starting from vertex 0; 3 vertices total -> 1 triangle
+enum HudElementId {
+	HUD_LIVES,
+	HUD_LEVEL,
+	HUD_ELEMENTS
+};
+
+struct HudVertex {
+	GLfloat x, y;    // font units, one unit per em
+	GLfloat u, v;
+	GLubyte color[4];
+};
+
+struct HudElement {
+	int value;                  // game value the text shows
+	glm::vec3 color;
+	bool dirty;                 // value or color changed since the last layout
+	vector<HudVertex> vertices; // laid out text
+};
 
-	// Unbind Textures to be safe
-	glBindTexture(GL_TEXTURE_2D, 0);
+struct HudBatch {
+	vector<GlyphInfo> glyphs; // copied out of the atlas, whose pixels are dropped after upload
+	float pixelSize, atlasWidth, atlasHeight;
+	GLuint texture;
+	GLuint vertexArray, vertexBuffer;
+	HudElement elements[HUD_ELEMENTS];
+	int vertexCount;          // in vertexBuffer
+	int matrixSlot, atlasSlot;
+	int layouts, uploads;     // since startup
+} hud;
+
+/* Upload the atlas to its own texture unit and keep the glyph metrics */
+void createGlyphAtlasTexture (const GlyphAtlas& atlas)
+{
+	const GlyphAtlasHeader& header = atlas.header();
+	hud.glyphs.assign(&atlas.glyph(0), &atlas.glyph(0) + header.glyphs);
+	hud.pixelSize = header.pixelSize;
+	hud.atlasWidth = header.width;
+	hud.atlasHeight = header.height;
+
+	glActiveTexture(GL_TEXTURE0 + HUD_TEXTURE_UNIT);
+	glGenTextures(1, &hud.texture);
+	glBindTexture(GL_TEXTURE_2D, hud.texture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, header.width, header.height, 0, GL_RED, GL_UNSIGNED_BYTE, atlas.pixels());
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glActiveTexture(GL_TEXTURE0);
 }
 
-/* Create an OpenGL Texture from an image */
-GLuint createTexture (const char* filename)
+/* Vertex array of the batch, in the layout of fontrender.vert */
+void createHudBatch ()
 {
-	GLuint TextureID;
-	// Generate Texture Buffer
-	glGenTextures(1, &TextureID);
-	// All upcoming GL_TEXTURE_2D operations now have effect on our texture buffer
-	glBindTexture(GL_TEXTURE_2D, TextureID);
-	// Set our texture parameters
-	// Set texture wrapping to GL_REPEAT
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	// Set texture filtering (interpolation)
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	hud.vertexCount = 0;
+	hud.layouts = hud.uploads = 0;
+	for (int e=0; e<HUD_ELEMENTS; e++) {
+		hud.elements[e].value = INT_MIN;
+		hud.elements[e].dirty = true;
+	}
+	hud.matrixSlot = fontProgram.uniform("MVP");
+	hud.atlasSlot = fontProgram.uniform("glyphAtlas");
+	useProgram(fontProgram.ProgramID);
+	fontProgram.setInt(hud.atlasSlot, HUD_TEXTURE_UNIT);
+
+	glGenVertexArrays(1, &hud.vertexArray);
+	glGenBuffers(1, &hud.vertexBuffer);
+	bindVertexArray(hud.vertexArray);
+	glBindBuffer(GL_ARRAY_BUFFER, hud.vertexBuffer);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(HudVertex), (void*) offsetof(HudVertex, x));
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(HudVertex), (void*) offsetof(HudVertex, u));
+	glEnableVertexAttribArray(2);
+	glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(HudVertex), (void*) offsetof(HudVertex, color));
+	bindVertexArray(0);
+}
+
+/* Quads for a string with its pen starting at (x, y), in font units */
+void layoutHudText (float x, float y, const char* text, const glm::vec3& color, vector<HudVertex>& vertices)
+{
+	GLubyte rgba[4] = { (GLubyte) (color[0]*255), (GLubyte) (color[1]*255), (GLubyte) (color[2]*255), 255 };
+	float scale = 1.0f / hud.pixelSize;
+	for (const char* c=text; *c; c++) {
+		int i = (unsigned char) *c - GLYPH_FIRST;
+		if (i < 0 || i >= (int) hud.glyphs.size())
+			continue;
+		const GlyphInfo& glyph = hud.glyphs[i];
+		if (glyph.width > 0 && glyph.height > 0) {
+			float x0 = x + glyph.left*scale, x1 = x0 + glyph.width*scale;
+			float y1 = y + glyph.top*scale, y0 = y1 - glyph.height*scale;
+			float u0 = glyph.x / hud.atlasWidth, u1 = (glyph.x + glyph.width) / hud.atlasWidth;
+			float v0 = glyph.y / hud.atlasHeight, v1 = (glyph.y + glyph.height) / hud.atlasHeight;
+			HudVertex quad[6] = {
+				{ x0, y0, u0, v1 }, { x1, y0, u1, v1 }, { x1, y1, u1, v0 },
+				{ x0, y0, u0, v1 }, { x1, y1, u1, v0 }, { x0, y1, u0, v0 },
+			};
+			for (int k=0; k<6; k++) {
+				memcpy(quad[k].color, rgba, 4);
+				vertices.push_back(quad[k]);
+			}
+		}
+		x += glyph.advance*scale;
+	}
+}
 
-	// Load image and create OpenGL texture
-	int twidth, theight;
-	unsigned char* image = SOIL_load_image(filename, &twidth, &theight, 0, SOIL_LOAD_RGB);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, twidth, theight, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
-	glGenerateMipmap(GL_TEXTURE_2D); // Generate MipMaps to use
-	SOIL_free_image_data(image); // Free the data read from file after creating opengl texture
-	glBindTexture(GL_TEXTURE_2D, 0); // Unbind texture when done, so we won't accidentily mess it up
+/* Text of an element for a value, empty when it shows nothing */
+void formatHudElement (int element, int value, char* text, size_t size)
+{
+	text[0] = 0;
+	if (element == HUD_LIVES && value >= 1 && value <= 4)
+		snprintf(text, size, value == 1 ? "    lives: %d" : "     lives: %d", value);
+	else if (element == HUD_LEVEL && value >= 1 && value <= numLevels)
+		snprintf(text, size, "                   level: %d", value);
+}
 
-	return TextureID;
+/* Bind an element to its current value, it is laid out again only if that differs */
+void setHudElement (int element, int value, const glm::vec3& color)
+{
+	HudElement& e = hud.elements[element];
+	if (e.value != value || e.color != color) {
+		e.value = value;
+		e.color = color;
+		e.dirty = true;
+	}
+}
+
+/* Lay out the dirty elements and upload the buffer again, nothing when none changed */
+void updateHud ()
+{
+	if (hud.glyphs.empty())
+		return; // the atlas is still loading, the elements stay dirty
+	bool changed = false;
+	for (int i=0; i<HUD_ELEMENTS; i++) {
+		HudElement& e = hud.elements[i];
+		if (!e.dirty)
+			continue;
+		char text[64];
+		formatHudElement(i, e.value, text, sizeof(text));
+		e.vertices.clear();
+		layoutHudText(0, 0, text, e.color, e.vertices);
+		e.dirty = false;
+		changed = true;
+		hud.layouts++;
+	}
+	if (!changed)
+		return;
+
+	vector<HudVertex> vertices;
+	for (int i=0; i<HUD_ELEMENTS; i++)
+		vertices.insert(vertices.end(), hud.elements[i].vertices.begin(), hud.elements[i].vertices.end());
+	hud.vertexCount = vertices.size();
+	glBindBuffer(GL_ARRAY_BUFFER, hud.vertexBuffer);
+	glBufferData(GL_ARRAY_BUFFER, vertices.size()*sizeof(HudVertex), vertices.empty() ? NULL : &vertices[0], GL_DYNAMIC_DRAW);
+	hud.uploads++;
 }
 
+/* Draw every element in one call, over the scene */
+void drawHud (const glm::mat4& MVP)
+{
+	if (hud.vertexCount == 0)
+		return;
+	useProgram(fontProgram.ProgramID);
+	setPolygonMode(GL_FILL); // the queue may have ended on a wireframe object
+	fontProgram.setMat4(hud.matrixSlot, MVP);
+	bindVertexArray(hud.vertexArray);
+	glDisable(GL_DEPTH_TEST);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	glDrawArrays(GL_TRIANGLES, 0, hud.vertexCount);
+	glDisable(GL_BLEND);
+	glEnable(GL_DEPTH_TEST);
+	glState.draws++;
+}
 
 /**************************
  * Customizable functions *
@@ -350,30 +2509,18 @@ float triangle_rot_dir = 1;
 float rectangle_rot_dir = -1;
 bool triangle_rot_status = true;
 bool rectangle_rot_status = true;
-int j;
-float j2=1,j4=-2,j5=2.2,j6=-2;
-int m=15;
-int num[15],num1[10];
-float t=0,ct1=0;
-bool flagjump= false;
-float hx,hz,ox,oz,hz1,hx1;
+float ct1=0;
 float i1=-1,i2=3,i3=3,i4=0,i5=0,i6=0,i7=0,i8=1,i9=0;
 glm::mat4 rotateRectangle;
 float u_xn = -10.0,u_xp = 10.0,u_yn = -10.0,u_yp = 10.0;
 double xpos,ypos,yoffset,xoffset,yoffset1;
-float wy=-2,obsy=0.0;
-int flagwater=0,cflag1=0,cflag2=0,cflag=1,flagobs=0,flagobs1=0;
+int cflag1=0,cflag2=0,cflag=1;
 GLfloat cameraSpeed = 0.05f;
 glm::vec3 cameraPos;
 glm::vec3 cameraFront;
 glm::vec3 cameraUp;
 float h1=-1,h2=3,h3=3;
-int score=0;
 float hj;
-int levelflag=1;
-int textflag=1;
-int speedflag=4;
-int life=4;
 bool camfollow=false;
 //char cflag='v';
 
@@ -382,6 +2529,87 @@ glm::vec3 target (0, 0, 0);
 glm::vec3 up (0, 1, 0);
     
 
+/* Input scripts : "<step> <key>" lines, the key is released at that simulation step.
+ * Keys are LEFT, RIGHT, UP, DOWN, SPACE or a single letter, '#' starts a comment. */
+struct ScriptedKey {
+	long long step;
+	int key;
+};
+
+vector<ScriptedKey> inputScript;
+ofstream inputRecording;
+long long simStep = 0; // simulation steps since start, the time base of scripts
+
+struct KeyName {
+	const char* name;
+	int key;
+} keyNames[] = {
+	{"LEFT", GLFW_KEY_LEFT}, {"RIGHT", GLFW_KEY_RIGHT}, {"UP", GLFW_KEY_UP},
+	{"DOWN", GLFW_KEY_DOWN}, {"SPACE", GLFW_KEY_SPACE},
+};
+
+int keyFromName (const string& name)
+{
+	for (size_t k=0; k<sizeof(keyNames)/sizeof(keyNames[0]); k++)
+		if (name == keyNames[k].name)
+			return keyNames[k].key;
+	if (name.size() == 1 && toupper(name[0]) >= 'A' && toupper(name[0]) <= 'Z')
+		return GLFW_KEY_A + (toupper(name[0]) - 'A');
+	return -1;
+}
+
+string nameFromKey (int key)
+{
+	for (size_t k=0; k<sizeof(keyNames)/sizeof(keyNames[0]); k++)
+		if (key == keyNames[k].key)
+			return keyNames[k].name;
+	if (key >= GLFW_KEY_A && key <= GLFW_KEY_Z)
+		return string(1, (char) ('A' + key - GLFW_KEY_A));
+	return "";
+}
+
+bool compareScriptedKeys (const ScriptedKey& a, const ScriptedKey& b)
+{
+	return a.step < b.step;
+}
+
+bool loadInputScript (const char* path)
+{
+	ifstream in(path);
+	if (!in.is_open()) {
+		cout << "Could not open input script " << path << endl;
+		return false;
+	}
+	string line;
+	int lineNumber = 0;
+	while (getline(in, line)) {
+		lineNumber++;
+		size_t comment = line.find('#');
+		if (comment != string::npos)
+			line.erase(comment);
+		istringstream fields(line);
+		ScriptedKey event;
+		string name;
+		if (!(fields >> event.step))
+			continue; // blank or comment line
+		if (!(fields >> name) || (event.key = keyFromName(name)) < 0) {
+			cout << path << ":" << lineNumber << ": unknown key" << endl;
+			return false;
+		}
+		inputScript.push_back(event);
+	}
+	stable_sort(inputScript.begin(), inputScript.end(), compareScriptedKeys);
+	return true;
+}
+
+/* Append a released key to the recording, if one was asked for with --record */
+void recordKey (int key)
+{
+	string name = nameFromKey(key);
+	if (inputRecording.is_open() && !name.empty())
+		inputRecording << simStep << " " << name << "\n";
+}
+
 /* Executed when a regular key is pressed/released/held-down */
 /* Prefered for Keyboard events */
 
@@ -439,6 +2667,8 @@ void panright()
 void keyboard (GLFWwindow* window, int key, int scancode, int action, int mods)
 {
 	// Function is called first on GLFW_PRESS.
+	if (action == GLFW_RELEASE)
+		recordKey(key);
 
 	if (action == GLFW_RELEASE /*|| action == GLFW_REPEAT*/) {
 		switch (key) {
@@ -449,25 +2679,25 @@ void keyboard (GLFWwindow* window, int key, int scancode, int action, int mods)
 				triangle_rot_status = !triangle_rot_status;
 				break;
             case GLFW_KEY_LEFT:
-                 sound3.play();
+                 playEffect(SFX_WALK);
                  j=2;
                  break;
             case GLFW_KEY_RIGHT:
-                 sound3.play();
+                 playEffect(SFX_WALK);
                  j=1;       
                  break;
 
             case GLFW_KEY_UP:
-                 sound3.play();   
+                 playEffect(SFX_WALK);   
                  j=3;
                  break;
             case GLFW_KEY_DOWN:
-                 sound3.play();
+                 playEffect(SFX_WALK);
                  j=4;       
                  break;  
             case GLFW_KEY_SPACE:
                  j=5;
-                 sound2.play();
+                 playEffect(SFX_JUMP);
                  break;
             case GLFW_KEY_C:
                 j2=j2-1;
@@ -624,7 +2854,7 @@ void mouseButton (GLFWwindow* window, int button, int action, int mods)
 		case GLFW_MOUSE_BUTTON_LEFT:
 			if (action == GLFW_RELEASE)
 				triangle_rot_dir *= -1;
-                sound2.play();
+                playEffect(SFX_JUMP);
                 j=5;
 			break;
 		case GLFW_MOUSE_BUTTON_RIGHT:
@@ -645,7 +2875,8 @@ void reshapeWindow (GLFWwindow* window, int width, int height)
 	int fbwidth=width, fbheight=height;
 	/* With Retina display on Mac OS X, GLFW's FramebufferSize
 	 is different from WindowSize */
-	glfwGetFramebufferSize(window, &fbwidth, &fbheight);
+	if (window) // NULL when rendering offscreen
+		glfwGetFramebufferSize(window, &fbwidth, &fbheight);
 
 	GLfloat fov = 90.0f;
 
@@ -664,7 +2895,15 @@ void reshapeWindow (GLFWwindow* window, int width, int height)
 	Matrices.projection = glm::ortho(-14.0f, 14.0f, -14.0f, 14.0f, 0.1f, 500.0f);
 }
 
-VAO *triangle, *rectangle, *cube[100], *player, *obst[10];
+VAO *triangle, *rectangle, *cube, *player, *obst[10];
+
+/* Layers of the texture array, in the order initGL loads the images */
+enum TextureLayers {
+	LAYER_BACKGROUND, // bg2.jpg
+	LAYER_TILE,       // cube2.jpg
+	LAYER_PLAYER,     // cube.bmp
+	TEXTURE_LAYERS
+};
 
 // Creates the triangle object used in this sample code
 
@@ -691,7 +2930,7 @@ void createTriangle ()
 }
 
 // Creates the rectangle object used in this sample code
-void createRectangle (GLuint textureID)
+void createRectangle (GLuint textureID, int layer)
 {
 	// GL3 accepts only Triangles. Quads are not supported
 	static const GLfloat vertex_buffer_data [] = {
@@ -726,11 +2965,11 @@ void createRectangle (GLuint textureID)
 	};
 
 	// create3DTexturedObject creates and returns a handle to a VAO that can be used later
-	rectangle = create3DTexturedObject( GL_TRIANGLES, 6, vertex_buffer_data, texture_buffer_data, textureID, GL_FILL);
+	rectangle = create3DTexturedObject( GL_TRIANGLES, 6, vertex_buffer_data, texture_buffer_data, textureID, layer, GL_FILL);
 }
 
 
-void createCube(GLuint textureID1, int n)
+void createCube(GLuint textureID, int layer)
 {
   const GLfloat vertex_buffer_data [] = {
      -0.2f,-2.0f,-0.2f, // triangle 1 : begin
@@ -842,901 +3081,578 @@ void createCube(GLuint textureID1, int n)
         0.335973f, 1.0f-0.335903f, 
         0.667969f, 1.0f-0.671889f, 
         1.000004f, 1.0f-0.671847f, 
-        0.667979f, 1.0f-0.335851f
-    };
-  // create3DObject creates and returns a handle to a VAO that can be used later
-   cube[n]= create3DTexturedObject(GL_TRIANGLES, 36, vertex_buffer_data, texture_buffer_data, textureID1, GL_FILL);
-
-}
-
-
-void createPlayer(GLuint textureID2)
-{
-  // GL3 accepts only Triangles. Quads are not supported static
-  const GLfloat vertex_buffer_data [] = {
-    -0.1f,-0.2f,-0.1f, // triangle 1 : begin
-
-     -0.1f,-0.2f, 0.1f,
-
-     -0.1f, 0.2f, 0.1f, // triangle 1 : end
-
-     0.1f, 0.2f,-0.1f, // triangle 2 : begin
-
-     -0.1f,-0.2f,-0.1f,
-
-     -0.1f, 0.2f,-0.1f, // triangle 2 : end
-
-     0.1f,-0.2f, 0.1f,
-
-     -0.1f,-0.2f,-0.1f,
-
-     0.1f,-0.2f,-0.1f,
-
-     0.1f,0.2f,-0.1f,
-
-     0.1f,-0.2f,-0.1f,
-
-     -0.1f,-0.2f,-0.1f,
-
-     -0.1f,-0.2f,-0.1f,
-
-     -0.1f, 0.2f, 0.1f,
-
-     -0.1f, 0.2f,-0.1f,
-
-     0.1f,-0.2f, 0.1f,
-
-     -0.1f,-0.2f, 0.1f,
-
-     -0.1f,-0.2f,-0.1f,
-
-     -0.1f, 0.2f, 0.1f,
-
-     -0.1f,-0.2f, 0.1f,
-
-     0.1f,-0.2f, 0.1f,
-
-     0.1f, 0.2f, 0.1f,
-
-     0.1f,-0.2f,-0.1f,
-
-     0.1f, 0.2f,-0.1f,
-
-     0.1f,-0.2f,-0.1f,
-
-     0.1f, 0.2f, 0.1f,
-
-     0.1f,-0.2f, 0.1f,
-
-     0.1f, 0.2f, 0.1f,
-
-     0.1f, 0.2f,-0.1f,
-
-     -0.1f, 0.2f,-0.1f,
-
-     0.1f, 0.2f, 0.1f,
-
-     -0.1f, 0.2f,-0.1f,
-
-     -0.1f, 0.2, 0.1f,
-
-     0.1f, 0.2f, 0.1f,
-
-     -0.1f, 0.2f, 0.1f,
-
-     0.1f,-0.2f, 0.1f
-    
-
-  };
- static const GLfloat texture_buffer_data[] = { 
-        0.000059f, 1.0f-0.000004f, 
-        0.000103f, 1.0f-0.336048f, 
-        0.335973f, 1.0f-0.335903f, 
-        1.000023f, 1.0f-0.000013f, 
-        0.667979f, 1.0f-0.335851f, 
-        0.999958f, 1.0f-0.336064f, 
-        0.667979f, 1.0f-0.335851f, 
-        0.336024f, 1.0f-0.671877f, 
-        0.667969f, 1.0f-0.671889f, 
-        1.000023f, 1.0f-0.000013f, 
-        0.668104f, 1.0f-0.000013f, 
-        0.667979f, 1.0f-0.335851f, 
-        0.000059f, 1.0f-0.000004f, 
-        0.335973f, 1.0f-0.335903f, 
-        0.336098f, 1.0f-0.000071f, 
-        0.667979f, 1.0f-0.335851f, 
-        0.335973f, 1.0f-0.335903f, 
-        0.336024f, 1.0f-0.671877f, 
-        1.000004f, 1.0f-0.671847f, 
-        0.999958f, 1.0f-0.336064f, 
-        0.667979f, 1.0f-0.335851f, 
-        0.668104f, 1.0f-0.000013f, 
-        0.335973f, 1.0f-0.335903f, 
-        0.667979f, 1.0f-0.335851f, 
-        0.335973f, 1.0f-0.335903f, 
-        0.668104f, 1.0f-0.000013f, 
-        0.336098f, 1.0f-0.000071f, 
-        0.000103f, 1.0f-0.336048f, 
-        0.000004f, 1.0f-0.671870f, 
-        0.336024f, 1.0f-0.671877f, 
-        0.000103f, 1.0f-0.336048f, 
-        0.336024f, 1.0f-0.671877f, 
-        0.335973f, 1.0f-0.335903f, 
-        0.667969f, 1.0f-0.671889f, 
-        1.000004f, 1.0f-0.671847f, 
-        0.667979f, 1.0f-0.335851f
-    };
-  // create3DObject creates and returns a handle to a VAO that can be used later
-player= create3DTexturedObject(GL_TRIANGLES, 36, vertex_buffer_data, texture_buffer_data, textureID2, GL_FILL);
-  // create3DObject creates and returns a handle to a VAO that can be used later
-}
-
-
-
-int hole(int h)
-{
-    
-    hx=-2+(((h%10)-1)*0.4);
-    hz= -2 + (h/10)*0.4;
-    hx1=hx;
-    hz1=hz;
-   /* if(h%10==0)
-    {
-    cout<<h<<"\n";
-    cout << hx <<"\t" << hz<<"\n";
-}*/
-}
-int obstacle(int o)
-{
-    ox=-2+(((o%10)-1)*0.4);
-    oz= -2 + (o/10)*0.4;
-
-}
-void check1 ()
-{
-                                       
-  if(j4<-2 || j6<-2 || j4>1.6 || j6>1.6)
-  {
-    j4=-2;
-    j6=-2;
-    j=0;
-    score++;
-    life--;
-    sound6.play();
-  } 
-for(int c=0;c<15;c++)
-{
-    hole(num[c]);
-    if(j4>hx-0.2 && j4<hx+0.2 && j6>hz-0.2 && j6<hz+0.2  )
-    {
-        j4=-2;
-        j6=-2;
-        j=0;
-        life--; 
-       score++;
-       sound6.play();
-    }
- 
-}
-for(int c=0;c<10;c++)
-{
-    obstacle(num1[c]);
-     if(j4>ox-0.2 && j4<ox+0.2 && j6>oz-0.2 && j6<oz+0.2 && j5<=3 && j5>obsy+3 && flagobs1==0)
-    {
-        j4=-2;
-        j6=-2;
-        j=0;
-        life--;
-        score++;
-        sound7.play();
-        flagobs1=1;
-    }
-
-}
-if(j6>1.4 && j4>1.4 )
-{
-    cout<<"You win \n";
-  //  if(levelflag==4)
-    {
-    levelflag++;
-    cout<<" Second level \n";
-    
-    }
-     j4=-2;
-        j6=-2;
-        j=0;
-        sound5.play();
-    
-}
-}
-void check2 ()
-{
-                                       
-  if(j4<-2 || j6<-2 || j4>1.6 || j6>1.6)
-  {
-    j4=-2;
-    j6=-2;
-    j=0;
-    score++;
-    life--;
-    sound6.play();
-  } 
-for(int c=0;c<15;c++)
-{
-    hole(num[c]);
-    if(j4>hx-0.2 && j4<hx+0.2 && j6>hz-0.2 && j6<hz+0.2  )
-    {
-        j4=-2;
-        j6=-2;
-        j=0;
-        life--; 
-       score++;
-       sound6.play();
-    }
-
- 
-}
-
-for(int c=0;c<10;c++)
-{
-    obstacle(num1[c]);
-         if(j4>ox-0.2 && j4<ox+0.2 && j6>oz-0.2 && j6<oz+0.2 && j5<=3 && j5>obsy+3 && flagobs1==0)
-    {
-        j4=-2;
-        j6=-2;
-        j=0;
-        life--;
-        score++;
-        sound7.play();
-        flagobs1=1;
-    }
-    
-
-}
-if(j6>1.4 && j4>1.4 )
-{
-    cout<<"You win \n";
-
-    levelflag++;
-    cout<<"Nextlevel \n";
-     j4=-2;
-        j6=-2;
-        j=0;
-    sound5.play();
-    
-    
-}
-}
-void check3 ()
-{
-                                       
-  if(j4<-2 || j6<-2 || j4>1.6 || j6>1.6)
-  {
-    j4=-2;
-    j6=-2;
-    j=0;
-    score++;
-    life--;
-    sound6.play();
-  } 
-for(int c=0;c<15;c++)
-{
-    hole(num[c]);
-    if(j4>hx-0.2 && j4<hx+0.2 && j6>hz-0.2 && j6<hz+0.2  )
-    {
-        j4=-2;
-        j6=-2;
-        j=0;
-        life--; 
-       score++;
-       sound6.play();
-    }
- 
-}
-for(int c=0;c<10;c++)
-{
-    obstacle(num1[c]);
-        if(j4>ox-0.2 && j4<ox+0.2 && j6>oz-0.2 && j6<oz+0.2 && j5<=3 && j5>obsy+3 && flagobs1==0)
-    {
-        j4=-2;
-        j6=-2;
-        j=0;
-        life--;
-        score++;
-        sound7.play();
-        flagobs1=1;
-    }
-    /*else if(j5==1)
-    {
-
-    }*/
-
-}
-if(j6>1.4 && j4>1.4 )
-{
-    cout<<"You win \n";
-   
-    {
-    levelflag++;
-    cout<<"Nextlevel \n";
-    
-    }
-     j4=-2;
-        j6=-2;
-        j=0;
-        sound5.play();
-    
-}
-}
+        0.667979f, 1.0f-0.335851f
+    };
+  // create3DObject creates and returns a handle to a VAO that can be used later
+   cube= create3DTexturedObject(GL_TRIANGLES, packTexturedMesh(36, vertex_buffer_data, texture_buffer_data), textureID, layer, GL_FILL);
 
-void check4 ()
-{
-                                       
-  if(j4<-2 || j6<-2 || j4>1.6 || j6>1.6)
-  {
-    j4=-2;
-    j6=-2;
-    j=0;
-    score++;
-    life--;
-    sound6.play();
-  } 
-for(int c=0;c<15;c++)
-{
-    hole(num[c]);
-    if(j4>hx-0.2 && j4<hx+0.2 && j6>hz-0.2 && j6<hz+0.2  )
-    {
-        j4=-2;
-        j6=-2;
-        j=0;
-        life--; 
-       score++;
-       sound6.play();
-    }
- 
 }
-for(int c=0;c<10;c++)
-{
-    obstacle(num1[c]);
-     if(j4>ox-0.2 && j4<ox+0.2 && j6>oz-0.2 && j6<oz+0.2 && j5<=3 && j5>obsy+3 && flagobs1==0)
-    {
-        j4=-2;
-        j6=-2;
-        j=0;
-        life--;
-        score++;
-        sound7.play();
-        flagobs1=1;
-    }
-    /*else if(j5==1)
-    {
 
-    }*/
 
-}
-if(j6>1.4 && j4>1.4 )
-{
-    cout<<"You win \n";
-    //if(levelflag==4)
-    {
-    levelflag++;
-    cout<<"Nextlevel \n";
-    
-    }
-     j4=-2;
-        j6=-2;
-        j=0;
-        sound5.play();
-    
-}
-}
-void check5 ()
-{
-                                       
-  if(j4<-2 || j6<-2 || j4>1.6 || j6>1.6)
-  {
-    j4=-2;
-    j6=-2;
-    j=0;
-    score++;
-    life--;
-    sound6.play();
-  } 
-for(int c=0;c<15;c++)
-{
-    hole(num[c]);
-    if(j4>hx-0.2 && j4<hx+0.2 && j6>hz-0.2 && j6<hz+0.2  )
-    {
-        j4=-2;
-        j6=-2;
-        j=0;
-        life--; 
-       score++;
-       sound6.play();
-    }
- 
-}
-for(int c=0;c<10;c++)
+void createPlayer(GLuint textureID, int layer)
 {
-    obstacle(num1[c]);
-     if(j4>ox-0.2 && j4<ox+0.2 && j6>oz-0.2 && j6<oz+0.2 && j5<=3 && j5>obsy+3 && flagobs1==0)
-    {
-        j4=-2;
-        j6=-2;
-        j=0;
-        life--;
-        score++;
-        sound7.play();
-        flagobs1=1;
-    }
-    /*else if(j5==1)
-    {
+  // GL3 accepts only Triangles. Quads are not supported static
+  const GLfloat vertex_buffer_data [] = {
+    -0.1f,-0.2f,-0.1f, // triangle 1 : begin
 
-    }*/
+     -0.1f,-0.2f, 0.1f,
 
-}
-if(j6>1.4 && j4>1.4 )
-{
-    cout<<"You win \n";
-  //  if(levelflag==4)
-    {
-    levelflag++;
-    sound4.play();
-   // cout<<"Nextlevel \n";
-     j4=-2;
-        j6=-2;
-        j=0;
-    
-    }
-    
-}
-}
+     -0.1f, 0.2f, 0.1f, // triangle 1 : end
 
+     0.1f, 0.2f,-0.1f, // triangle 2 : begin
 
+     -0.1f,-0.2f,-0.1f,
 
+     -0.1f, 0.2f,-0.1f, // triangle 2 : end
 
+     0.1f,-0.2f, 0.1f,
 
-float camera_rotation_angle = 90;
-float rectangle_rotation = 0;
-float triangle_rotation = 0;
+     -0.1f,-0.2f,-0.1f,
 
+     0.1f,-0.2f,-0.1f,
 
-/* Render the scene with openGL */
-/* Edit this function according to your assignment */
-void draw ()
-{
-	// clear the color and depth in the frame buffer
-	glClear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+     0.1f,0.2f,-0.1f,
 
-	// use the loaded shader program
-	// Don't change unless you know what you are doing
-	glUseProgram (programID);
+     0.1f,-0.2f,-0.1f,
 
-	// Eye - Location of camera. Don't change unless you are sure!!
-	glm::vec3 eye ( 5*cos(camera_rotation_angle*M_PI/180.0f), 0, 5*sin(camera_rotation_angle*M_PI/180.0f) );
-	// Target - Where is the camera looking at.  Don't change unless you are sure!!
-	glm::vec3 target (0, 0, 0);
-	// Up - Up vector defines tilt of camera.  Don't change unless you are sure!!
-	glm::vec3 up (0, 1, 0);
+     -0.1f,-0.2f,-0.1f,
 
-	// Compute Camera matrix (view)
-	// Matrices.view = glm::lookAt( eye, target, up ); // Rotating Camera for 3D
-	//  Don't change unless you are sure!!
-	static float c = 0;
-	//c++;
-	//Matrices.view = glm::lookAt(glm::vec3(i1,i2,i3), glm::vec3(i4,i5,i6), glm::vec3(sinf(c*M_PI/180.0),3*cosf(c*M_PI/180.0),0)); // Fixed camera for 2D (ortho) in XY plane
-    if(cflag==1)
-    {
-        //tower view
-         i1=-1,i2=3,i3=3,i4=0,i5=0,i6=0,i7=0,i8=1,i9=0;
-          Matrices.view = glm::lookAt(glm::vec3(i1,i2,i3), glm::vec3(i4,i5,i6), glm::vec3(i7,i8,i9));
-    }
-    else if(cflag==2)
-    {
-        //top view
-        i1=0,i2=20,i3=1,i4=0,i5=0,i6=0,i7=0,i8=1,i9=0;
-         Matrices.view = glm::lookAt(glm::vec3(i1,i2,i3), glm::vec3(i4,i5,i6), glm::vec3(i7,i8,i9));
-    }
-    else if(cflag==3)
-    {
-        i1=j4;
-        i2=8;
-        i3=j6;
-        i4=j4+2;
-        i5=2;
-        i6=j6-2;
-        Matrices.view = glm::lookAt(glm::vec3(i1,i2,i3), glm::vec3(i4,i5,i6), glm::vec3(i7,i8,i9));
-    }
-    else if(cflag==4)
-    {
-        i1=j4+1;
-        i2=j5+4;
-        i3=j6-0.6;
-        i4=j4+1;
-        i5=j5;
-        i6=j6-1;
-        Matrices.view = glm::lookAt(glm::vec3(i1,i2,i3), glm::vec3(i4,i5,i6), glm::vec3(i7,i8,i9));
-    
-    }
-    else if(cflag==5)
-    {
-        if(hj==1)
-        {
-            i1=i1+0.5;
+     -0.1f,-0.2f,-0.1f,
 
-        }
-        else if(hj==2)
-        {
-            i1=i1-0.5;
-        }
-        else if(hj==3)
-        {
-            i2=i2-0.5;
-        }
-        else if(hj==4)
-        {
-            i2=i2+0.5;
-        }
+     -0.1f, 0.2f, 0.1f,
 
-        Matrices.view = glm::lookAt(glm::vec3(i1,i2,i3), glm::vec3(i4,i5,i6), glm::vec3(i7,i8,i9));
+     -0.1f, 0.2f,-0.1f,
 
-    }
-    if(cflag1==1)
-    {
-        GLfloat radius = 2.0f;
-    GLfloat camX = sin(ct1) * radius;
-    GLfloat camZ = cos(ct1) * radius;
-    glm::mat4 view;
-    Matrices.view = glm::lookAt(glm::vec3(camX, 1.0, camZ), glm::vec3(0.0, 0.0, 0.0), glm::vec3(0.0, 1.0, 0.0));
-ct1=ct1+0.002;
+     0.1f,-0.2f, 0.1f,
 
-    }
-    else if(cflag2==1)
-    {
-        i1=j4;
-        i2=j5;
-        i3=j6;
-        /*  i4=j4+2;
-        j5= i2;
-        i6=j6+2;*/
-        Matrices.view = glm::lookAt(glm::vec3(i1,i2,i3), glm::vec3(i4,i5,i6), glm::vec3(i7,i8,i9));
+     -0.1f,-0.2f, 0.1f,
 
-    }
-    else if(cflag1==3)
-    {
+     -0.1f,-0.2f,-0.1f,
 
-        h1=h1+0.2;
-        //h3=h3+0.5;
-        Matrices.view = glm::lookAt(glm::vec3(h1,h2,h3), glm::vec3(i4,i5,i6), glm::vec3(i7,i8,i9));
+     -0.1f, 0.2f, 0.1f,
 
-    }
-    /*else if(cflag1==4)
-    {
-        Matrices.view = glm::lookAt(glm::vec3(i1,i2,i3), glm::vec3(i4,i5,i6), glm::vec3(i7,i8,i9));
-    }*/
-    else
-    {
-    Matrices.view = glm::lookAt(glm::vec3(i1,i2,i3), glm::vec3(i4,i5,i6), glm::vec3(i7,i8,i9));
-    cflag1=0;
-    cflag2=0;
-    }
-	// Compute ViewProject matrix as view/camera might not be changed for this frame (basic scenario)
-	//  Don't change unless you are sure!!
-	glm::mat4 VP = Matrices.projection * Matrices.view;
+     -0.1f,-0.2f, 0.1f,
 
-	// Send our transformation to the currently bound shader, in the "MVP" uniform
-	// For each model you render, since the MVP will be different (at least the M part)
-	//  Don't change unless you are sure!!
-	glm::mat4 MVP;	// MVP = Projection * View * Model
+     0.1f,-0.2f, 0.1f,
 
-	// Load identity to model matrix
-	Matrices.model = glm::mat4(1.0f);
+     0.1f, 0.2f, 0.1f,
 
-	/* Render your scene */
-	glm::mat4 translateTriangle = glm::translate (glm::vec3(-2.0f, 0.0f, 0.0f)); // glTranslatef
-	glm::mat4 rotateTriangle = glm::rotate((float)(triangle_rotation*M_PI/180.0f), glm::vec3(0,0,1));  // rotate about vector (1,0,0)
-	glm::mat4 triangleTransform = translateTriangle * rotateTriangle;
-	Matrices.model *= triangleTransform;
-	MVP = VP * Matrices.model; // MVP = p * V * M
+     0.1f,-0.2f,-0.1f,
 
-	//  Don't change unless you are sure!!
-	// Copy MVP to normal shaders
-	glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
+     0.1f, 0.2f,-0.1f,
 
-	// draw3DObject draws the VAO given to it using current MVP matrix
-	draw3DObject(triangle);
+     0.1f,-0.2f,-0.1f,
 
+     0.1f, 0.2f, 0.1f,
 
+     0.1f,-0.2f, 0.1f,
 
-	// Render with texture shaders now
-	glUseProgram(textureProgramID);
+     0.1f, 0.2f, 0.1f,
 
-	// Pop matrix to undo transformations till last push matrix instead of recomputing model matrix
-	// glPopMatrix ();
+     0.1f, 0.2f,-0.1f,
 
-if(wy<1 && flagwater==0)
-    {
-    //cout << "hekko"<<"\n";
-    wy=wy+0.01;
+     -0.1f, 0.2f,-0.1f,
 
-    }
-    else if(wy>=1)
-    { 
-    flagwater=1;
-    wy=wy-0.01;
-    }
-    else if(flagwater==1 && wy>-3)
-    {
-    wy=wy-0.01;
-    }
-    else if(flagwater==1 && wy<=-3)
-    {
-    //cout << "hekko"<<"\n";   
-    wy=wy+0.01;
-    flagwater=0;
-    }        
+     0.1f, 0.2f, 0.1f,
 
+     -0.1f, 0.2f,-0.1f,
 
+     -0.1f, 0.2, 0.1f,
 
-	Matrices.model = glm::mat4(1.0f);
+     0.1f, 0.2f, 0.1f,
 
-	glm::mat4 translateRectangle = glm::translate (glm::vec3(0, wy, -4));        // glTranslatef
-	//glm::mat4 rotateRectangle = glm::rotate((float)(rectangle_rotation*M_PI/180.0f), glm::vec3(0,0,1)); // rotate about vector (-1,1,1)
-	Matrices.model *= (translateRectangle * rotateRectangle);
-	MVP = VP * Matrices.model;
+     -0.1f, 0.2f, 0.1f,
+
+     0.1f,-0.2f, 0.1f
+    
 
-	// Copy MVP to texture shaders
-	glUniformMatrix4fv(Matrices.TexMatrixID, 1, GL_FALSE, &MVP[0][0]);
+  };
+ static const GLfloat texture_buffer_data[] = { 
+        0.000059f, 1.0f-0.000004f, 
+        0.000103f, 1.0f-0.336048f, 
+        0.335973f, 1.0f-0.335903f, 
+        1.000023f, 1.0f-0.000013f, 
+        0.667979f, 1.0f-0.335851f, 
+        0.999958f, 1.0f-0.336064f, 
+        0.667979f, 1.0f-0.335851f, 
+        0.336024f, 1.0f-0.671877f, 
+        0.667969f, 1.0f-0.671889f, 
+        1.000023f, 1.0f-0.000013f, 
+        0.668104f, 1.0f-0.000013f, 
+        0.667979f, 1.0f-0.335851f, 
+        0.000059f, 1.0f-0.000004f, 
+        0.335973f, 1.0f-0.335903f, 
+        0.336098f, 1.0f-0.000071f, 
+        0.667979f, 1.0f-0.335851f, 
+        0.335973f, 1.0f-0.335903f, 
+        0.336024f, 1.0f-0.671877f, 
+        1.000004f, 1.0f-0.671847f, 
+        0.999958f, 1.0f-0.336064f, 
+        0.667979f, 1.0f-0.335851f, 
+        0.668104f, 1.0f-0.000013f, 
+        0.335973f, 1.0f-0.335903f, 
+        0.667979f, 1.0f-0.335851f, 
+        0.335973f, 1.0f-0.335903f, 
+        0.668104f, 1.0f-0.000013f, 
+        0.336098f, 1.0f-0.000071f, 
+        0.000103f, 1.0f-0.336048f, 
+        0.000004f, 1.0f-0.671870f, 
+        0.336024f, 1.0f-0.671877f, 
+        0.000103f, 1.0f-0.336048f, 
+        0.336024f, 1.0f-0.671877f, 
+        0.335973f, 1.0f-0.335903f, 
+        0.667969f, 1.0f-0.671889f, 
+        1.000004f, 1.0f-0.671847f, 
+        0.667979f, 1.0f-0.335851f
+    };
+  // create3DObject creates and returns a handle to a VAO that can be used later
+player= create3DTexturedObject(GL_TRIANGLES, packTexturedMesh(36, vertex_buffer_data, texture_buffer_data), textureID, layer, GL_FILL);
+  // create3DObject creates and returns a handle to a VAO that can be used later
+}
 
-	// Set the texture sampler to access Texture0 memory
-	glUniform1i(glGetUniformLocation(textureProgramID, "texSampler"), 0);
 
-	// draw3DObject draws the VAO given to it using current MVP matrix
-	draw3DTexturedObject(rectangle);
+/* Per-tile data streamed to GridInstanced.vert through attributes 3 and 4 */
+struct TileInstance {
+	GLfloat x, z;     // tile offset on the board
+	GLfloat obstacle; // 1 for obstacle tiles, which follow obsy
+	GLfloat visible;  // 0 for holes
+	GLfloat layer;    // texture array layer
+};
 
-int i;
-float xc=-2;
-float zc=-2;
-int q=0;
+/* Square block of tiles. Its static tiles (neither holes nor obstacles) are baked into an
+ * instance buffer of their own, rebuilt only when a re-roll changed one of its tiles. */
+const int GRID_CHUNK = 16;
+
+struct GridChunk {
+	int col0, row0, cols, rows;
+	bool inView;
+	bool dirty;            // tiles changed since the buffer was baked
+	struct VAO vao;        // the tile cube, instanced from instanceBuffer
+	GLuint instanceBuffer;
+	int numStatic;         // tiles in instanceBuffer
+	vector<int> obstacles; // obstacle tiles, drawn with the moving ones of the other chunks
+};
 
-for(int c=0;c<m;c++)
+/* Draws the board : one instanced draw per chunk in view for the static tiles, plus one
+ * for the obstacle tiles of those chunks, which move with the obstacleHeight uniform */
+struct InstancedGrid {
+	VAO* mesh; // single cube shared by every tile
+	GLuint InstanceBuffer; // obstacle tiles of the chunks in view
+	ShaderProgram program;
+	int MatrixID;
+	int RotationID;
+	int ObstacleHeightID;
+	int SamplerID;
+	int NumTiles;
+	int NumObstacles;
+	int NumDrawn; // obstacle instances in InstanceBuffer
+	int layoutVersion; // layoutVersion the tiles were classified for
+	bool upload; // obstacles or the chunks in view changed since the last upload
+	vector<TileInstance> tiles;
+	vector<GridChunk> chunks;
+	int chunkCols; // chunks per row of the board
+
+	// Centre and half size of the box around each chunk's tile centres, split into
+	// arrays for the culling pass, which tests four chunks per step
+	vector<float> chunkX, chunkZ, chunkHalfX, chunkHalfZ;
+
+	vector<TileInstance> drawn; // obstacle tiles in view, as uploaded
+	long long bakes;            // chunk buffers built since startup
+} grid;
+
+/* Attribute 3 (x, z, obstacle, visible) and 4 (layer) of the bound VAO, one TileInstance per instance */
+void attachTileInstances (GLuint instanceBuffer)
 {
-    if(num[c]==1)
-    {
-        num[c]=23;
-    }
-    else if(num1[c]==1)
-    {
-        num1[c]=55;
-    }
+	glBindBuffer (GL_ARRAY_BUFFER, instanceBuffer);
+	glVertexAttribPointer(
+						  3,                    // attribute 3. Tile instances
+						  4,                    // size (x,z,obstacle,visible)
+						  GL_FLOAT,             // type
+						  GL_FALSE,             // normalized?
+						  sizeof(TileInstance), // stride
+						  (void*)0              // array buffer offset
+						  );
+	glVertexAttribPointer(
+						  4,                           // attribute 4. Texture layer, replacing the mesh's own
+						  1,                           // size (layer)
+						  GL_FLOAT,                    // type
+						  GL_FALSE,                    // normalized?
+						  sizeof(TileInstance),        // stride
+						  (void*)offsetof(TileInstance, layer) // array buffer offset
+						  );
+	glVertexAttribDivisor(3, 1); // advance once per tile, not per vertex
+	glVertexAttribDivisor(4, 1);
+	glEnableVertexAttribArray(3);
+	glEnableVertexAttribArray(4);
 }
 
-for(i=0;i<100;i++)
+/* Split the board into chunks, each with a VAO that draws the cube from its own buffer */
+void createGridChunks ()
 {
-	Matrices.model = glm::mat4(1.0f);
-	if(i!=0 && i%10==0)
-    {
-        xc=-2;
-        zc=zc+0.4;
-    }		  
-    q++;
-  glm::mat4 translateCube ;
-  if(q==num1[0]|| q==num1[1]||q==num1[2]||q==num1[3]||q==num1[4]||q==num1[5]||q==num1[6]||q==num1[7]||q==num1[8] || q==num1[9] )
-  {
-    if(obsy<1 && flagobs==0)
-    {
-    //cout << "hekko"<<"\n";
-    obsy=obsy+0.005;
-
-    }
-    else if(obsy>=1)
-    { 
-    flagobs=1;
-    obsy=obsy-0.005;
-    }
-    else if(flagobs==1 && obsy>-3)
-    {
-    obsy=obsy-0.005;
-    }
-    else if(flagobs==1 && obsy<=-3)
-    {
-    //cout << "hekko"<<"\n";   
-    obsy=obsy+0.005;
-    flagobs=0;
-    }        
-
-   translateCube = glm::translate (glm::vec3(1.f*xc, obsy,1.f*zc));
-
-  }
-  else
-    translateCube = glm::translate (glm::vec3(1.f*xc, 0.0f,1.f*zc));
-
-  Matrices.model *=(translateCube * rotateRectangle) ; 
-  MVP = VP * Matrices.model; // MVP = p * V * M
-
-  //  Don't change unless you are sure!!
-  glUniformMatrix4fv(Matrices.TexMatrixID, 1, GL_FALSE, &MVP[0][0]);
-
-  // Set the texture sampler to access Texture0 memory
-    glUniform1i(glGetUniformLocation(textureProgramID, "texSampler"), 0);
-
-    // draw3DObject draws the VAO given to it using current MVP matrix
-    //for(int c=0;c<m;c++)
-    {
-       // cout<<num[c]<<"\n";
-    if(q!=num[0]&&q!=num[1]&&q!=num[2]&&q!=num[3]&&q!=num[4]&&q!=num[5]&&q!=num[6]&&q!=num[7]&&q!=num[8]&&q!=num[9]&&q!=num[10]&&q!=num[11]&&q!=num[12]&&q!=num[13]&&q!=num[14])
-    {//cout<<num[c]<<"\n";
-    draw3DTexturedObject(cube[i]);
-    }
-    /*if(q==num1[0]&& q==num1[1]&&q==num1[2]&&q==num1[3]&&q==num1[4]&&q==num1[5]&&q==num1[6]&&q==num1[7]&&q==num1[8] && q==num1[9] )
-    {
-        translateCube = glm::translate (glm::vec3(1.f*xc, 2.0f,1.f*zc));
-        Matrices.model *=(translateCube * rotateRectangle) ; 
-         MVP = VP * Matrices.model;
-         glUniformMatrix4fv(Matrices.TexMatrixID, 1, GL_FALSE, &MVP[0][0]);
-         glUniform1i(glGetUniformLocation(textureProgramID, "texSampler"), 0);
-         draw3DTexturedObject(cube[i]);
-    */
-    
+	grid.chunkCols = (board.cols + GRID_CHUNK - 1) / GRID_CHUNK;
+	grid.chunks.clear();
+	for (int row=0; row<board.rows; row+=GRID_CHUNK)
+		for (int col=0; col<board.cols; col+=GRID_CHUNK) {
+			GridChunk chunk;
+			chunk.col0 = col;
+			chunk.row0 = row;
+			chunk.cols = min(GRID_CHUNK, board.cols - col);
+			chunk.rows = min(GRID_CHUNK, board.rows - row);
+			chunk.inView = false;
+			chunk.dirty = true;
+			chunk.numStatic = 0;
+			chunk.vao = *grid.mesh;
+
+			glGenVertexArrays(1, &chunk.vao.VertexArrayID);
+			glGenBuffers(1, &chunk.instanceBuffer);
+			glBindVertexArray(chunk.vao.VertexArrayID);
+			bindPackedVertexAttributes(&chunk.vao);
+			attachTileInstances(chunk.instanceBuffer);
+			grid.chunks.push_back(chunk);
+
+			const TileInstance& first = grid.tiles[row*board.cols + col];
+			const TileInstance& last = grid.tiles[(row + chunk.rows - 1)*board.cols + col + chunk.cols - 1];
+			grid.chunkX.push_back(0.5f*(first.x + last.x));
+			grid.chunkZ.push_back(0.5f*(first.z + last.z));
+			grid.chunkHalfX.push_back(0.5f*(last.x - first.x));
+			grid.chunkHalfZ.push_back(0.5f*(last.z - first.z));
+		}
+	glBindVertexArray(0);
 }
-    xc=xc+0.4;
 
+/* Attach a per-instance buffer to the cube VAO, for the obstacles, and build the chunks */
+void createInstancedGrid (VAO* mesh, int numTiles, const ShaderProgram& program)
+{
+	grid.mesh = mesh;
+	grid.NumTiles = numTiles;
+	grid.NumObstacles = 0;
+	grid.NumDrawn = 0;
+	grid.layoutVersion = layoutVersion - 1;
+	grid.upload = false;
+	grid.bakes = 0;
+	grid.tiles.resize(numTiles);
+	for (int i=0; i<numTiles; i++) {
+		TileInstance& tile = grid.tiles[i];
+		tile.x = tileX(i+1);
+		tile.z = tileZ(i+1);
+		tile.obstacle = 0;
+		tile.visible = -1; // not classified yet
+		tile.layer = mesh->TextureLayer;
+	}
 
+	grid.program = program;
+	grid.MatrixID = grid.program.uniform("MVP");
+	grid.RotationID = grid.program.uniform("tileRotation");
+	grid.ObstacleHeightID = grid.program.uniform("obstacleHeight");
+	grid.SamplerID = grid.program.uniform("texSampler");
+
+	glBindVertexArray (mesh->VertexArrayID);
+	glGenBuffers (1, &(grid.InstanceBuffer)); // VBO - obstacle instances
+	glBindBuffer (GL_ARRAY_BUFFER, grid.InstanceBuffer);
+	glBufferData (GL_ARRAY_BUFFER, max(1, scaledTileCount(MAX_OBSTACLES))*sizeof(TileInstance), NULL, GL_DYNAMIC_DRAW);
+	attachTileInstances(grid.InstanceBuffer);
+	createGridChunks();
+	glBindVertexArray (0);
+	invalidateGLState();
 }
 
-Matrices.model = glm::mat4(1.0f);
- glm::mat4 translatePlayer = glm::translate (glm::vec3(j4, j5, j6));        // glTranslatef
-    //glm::mat4 rotateRectangle = glm::rotate((float)(rectangle_rotation*M_PI/180.0f), glm::vec3(0,0,1)); // rotate about vector (-1,1,1)
-    Matrices.model *= (translatePlayer * rotateRectangle);
-    MVP = VP * Matrices.model;
-
-    // Copy MVP to texture shaders
-    glUniformMatrix4fv(Matrices.TexMatrixID, 1, GL_FALSE, &MVP[0][0]);
+/* Reclassify tiles as holes/obstacles, only when the layout changed. Chunks with a tile
+ * that changed are marked dirty and get their obstacle list rebuilt. */
+void classifyGridTiles ()
+{
+	if (grid.layoutVersion == layoutVersion)
+		return;
+
+	grid.NumObstacles = countObstacleTiles();
+	for (int i=0; i<grid.NumTiles; i++) {
+		int q = i+1; // tiles are numbered from 1 in num[] and num1[]
+		TileInstance& tile = grid.tiles[i];
+		GLfloat obstacle = isObstacleTile(q) ? 1 : 0;
+		GLfloat visible = isHoleTile(q) ? 0 : 1;
+		if (tile.obstacle == obstacle && tile.visible == visible)
+			continue;
+		tile.obstacle = obstacle;
+		tile.visible = visible;
+		int row = (q-1) / board.cols, col = (q-1) % board.cols;
+		grid.chunks[(row/GRID_CHUNK)*grid.chunkCols + col/GRID_CHUNK].dirty = true;
+	}
 
-    // Set the texture sampler to access Texture0 memory
-    glUniform1i(glGetUniformLocation(textureProgramID, "texSampler"), 0);
+	for (size_t c=0; c<grid.chunks.size(); c++) {
+		GridChunk& chunk = grid.chunks[c];
+		if (!chunk.dirty)
+			continue;
+		chunk.obstacles.clear();
+		for (int row=chunk.row0; row<chunk.row0 + chunk.rows; row++)
+			for (int i=row*board.cols + chunk.col0, end=i + chunk.cols; i<end; i++)
+				if (grid.tiles[i].obstacle && grid.tiles[i].visible)
+					chunk.obstacles.push_back(i);
+		grid.upload = true;
+	}
+	grid.layoutVersion = layoutVersion;
+}
 
-    // draw3DObject draws the VAO given to it using current MVP matrix
+/* Mark the chunks whose box reaches into the frustum, four chunks per step. The box spans
+ * the tile centres, grown by a tile's extent, at either obstacle height. Only the parts that
+ * differ between chunks are computed per chunk, the rest of each plane's reach once. */
+void cullGridChunks (const Frustum& f, float obstacleHeight)
+{
+	glm::vec3 center, extent;
+	transformBounds(rotateRectangle, grid.mesh->BoundsMin, grid.mesh->BoundsMax, center, extent);
+	center.y += 0.5f*obstacleHeight;
+	extent.y += 0.5f*fabsf(obstacleHeight);
+	float reach[6];
+	for (int p=0; p<6; p++)
+		reach[p] = planeReach(f.planes[p], center, extent);
+
+	bool changed = false;
+	int n = grid.chunks.size();
+	int c = 0;
+#if defined(__SSE__)
+	__m128 zero = _mm_setzero_ps();
+	for (; c+4<=n; c+=4) {
+		__m128 x = _mm_loadu_ps(&grid.chunkX[c]);
+		__m128 z = _mm_loadu_ps(&grid.chunkZ[c]);
+		__m128 hx = _mm_loadu_ps(&grid.chunkHalfX[c]);
+		__m128 hz = _mm_loadu_ps(&grid.chunkHalfZ[c]);
+		__m128 inside = _mm_cmpeq_ps(zero, zero);
+		for (int p=0; p<6; p++) {
+			const glm::vec4& plane = f.planes[p];
+			__m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(plane.x)), _mm_mul_ps(hx, _mm_set1_ps(fabsf(plane.x)))),
+								  _mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(plane.z)), _mm_mul_ps(hz, _mm_set1_ps(fabsf(plane.z)))));
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(d, _mm_set1_ps(reach[p])), zero));
+		}
+		int mask = _mm_movemask_ps(inside);
+		for (int k=0; k<4; k++) {
+			bool v = (mask >> k) & 1;
+			changed |= grid.chunks[c+k].inView != v;
+			grid.chunks[c+k].inView = v;
+		}
+	}
+#endif
+	for (; c<n; c++) {
+		bool inside = true;
+		for (int p=0; p<6 && inside; p++) {
+			const glm::vec4& plane = f.planes[p];
+			inside = plane.x*grid.chunkX[c] + fabsf(plane.x)*grid.chunkHalfX[c]
+				   + plane.z*grid.chunkZ[c] + fabsf(plane.z)*grid.chunkHalfZ[c] + reach[p] >= 0;
+		}
+		changed |= grid.chunks[c].inView != inside;
+		grid.chunks[c].inView = inside;
+	}
+	if (changed)
+		grid.upload = true;
+}
 
+/* Bake the static tiles of a chunk into its instance buffer */
+void bakeGridChunk (GridChunk& chunk)
+{
+	vector<TileInstance> instances;
+	instances.reserve(chunk.cols*chunk.rows);
+	for (int row=chunk.row0; row<chunk.row0 + chunk.rows; row++)
+		for (int i=row*board.cols + chunk.col0, end=i + chunk.cols; i<end; i++)
+			if (grid.tiles[i].visible && !grid.tiles[i].obstacle)
+				instances.push_back(grid.tiles[i]);
+	chunk.numStatic = instances.size();
+	glBindBuffer (GL_ARRAY_BUFFER, chunk.instanceBuffer);
+	glBufferData (GL_ARRAY_BUFFER, instances.size()*sizeof(TileInstance), instances.empty() ? NULL : &instances[0], GL_STATIC_DRAW);
+	chunk.dirty = false;
+	grid.bakes++;
+}
 
- if(obsy<1 && flagobs==0 && flagobs1==1)
-    {
-    //cout << "hekko"<<"\n";
-    obsy=obsy+0.005;
-    glm::mat4 translatePlayer = glm::translate (glm::vec3(j4, obsy, j6)); 
+/* Bake the dirty chunks in view, others wait until they come into view, and upload the
+ * obstacles when they or the chunks in view changed. Nothing to do on most frames. */
+void updateGridChunks ()
+{
+	int drawn = 0;
+	for (size_t c=0; c<grid.chunks.size(); c++) {
+		GridChunk& chunk = grid.chunks[c];
+		if (!chunk.inView)
+			continue;
+		if (chunk.dirty)
+			bakeGridChunk(chunk);
+		drawn += chunk.numStatic;
+	}
 
-    }
-    else if(obsy>=1 && flagobs1==1)
-    { 
-    flagobs=1;
-    obsy=obsy-0.005;
-        glm::mat4 translatePlayer = glm::translate (glm::vec3(j4, obsy, j6)); 
+	if (grid.upload) {
+		grid.drawn.clear();
+		for (size_t c=0; c<grid.chunks.size(); c++) {
+			const GridChunk& chunk = grid.chunks[c];
+			if (chunk.inView)
+				for (size_t k=0; k<chunk.obstacles.size(); k++)
+					grid.drawn.push_back(grid.tiles[chunk.obstacles[k]]);
+		}
+		grid.NumDrawn = grid.drawn.size();
+		if (grid.NumDrawn > 0) {
+			glBindBuffer (GL_ARRAY_BUFFER, grid.InstanceBuffer);
+			glBufferSubData (GL_ARRAY_BUFFER, 0, grid.NumDrawn*sizeof(TileInstance), &grid.drawn[0]);
+		}
+		grid.upload = false;
+	}
+	cullStats.tilesTested += grid.NumTiles;
+	cullStats.tilesDrawn += drawn + grid.NumDrawn;
+}
 
-    }
-    else if(flagobs==1 && obsy>-3 && flagobs1==1)
-    {
-    obsy=obsy-0.005;
-        glm::mat4 translatePlayer = glm::translate (glm::vec3(j4, obsy, j6)); 
+/* Queue the chunks in view and the obstacles, VP is Projection * View */
+void drawInstancedGrid (const glm::mat4& VP, float obstacleHeight)
+{
+	// Uniforms shared by all tiles, the MVP travels with the queued draws
+	useProgram (grid.program.ProgramID);
+	grid.program.setMat4(grid.RotationID, rotateRectangle);
+	grid.program.setFloat(grid.ObstacleHeightID, obstacleHeight);
+	grid.program.setInt(grid.SamplerID, 0);
+
+	for (size_t c=0; c<grid.chunks.size(); c++) {
+		GridChunk& chunk = grid.chunks[c];
+		if (chunk.inView && chunk.numStatic > 0)
+			submitDraw(grid.program, grid.MatrixID, &chunk.vao, VP, chunk.numStatic);
+	}
+	if (grid.NumDrawn > 0)
+		submitDraw(grid.program, grid.MatrixID, grid.mesh, VP, grid.NumDrawn);
+}
 
-    }
-    else if(flagobs==1 && obsy<=-3 && flagobs1==1)
-    {
-    //cout << "hekko"<<"\n";   
-    obsy=obsy+0.005;
-    flagobs=0;
-        glm::mat4 translatePlayer = glm::translate (glm::vec3(j4, obsy, j6)); 
 
-    }        
 
-  /*   if(flagobs1==1)
-            translateRectangle = glm::translate (glm::vec3(j4, obsy, j6));
+float camera_rotation_angle = 90;
+float rectangle_rotation = 0;
+float triangle_rotation = 0;
 
-*/
 
-    if(levelflag==1)
-    {
-    
-    check1();
+/* Advance the animated cameras (helicopter, rotating and 'h' views) one step */
+void stepCamera ()
+{
+	if(cflag==5)
+	{
+		if(hj==1)
+			i1=i1+0.5;
+		else if(hj==2)
+			i1=i1-0.5;
+		else if(hj==3)
+			i2=i2-0.5;
+		else if(hj==4)
+			i2=i2+0.5;
+	}
+	if(cflag1==1)
+		ct1=ct1+0.002;
+	else if(cflag2!=1 && cflag1==3)
+		h1=h1+0.2;
+	else if(cflag2!=1)
+		cflag1=0;
 }
-    draw3DTexturedObject(player);
 
+/* Render the scene with openGL */
+/* alpha in [0,1) is how far we are between the last two simulation steps */
+void draw (float alpha)
+{
+	// clear the color and depth in the frame buffer
+	glClear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    int k;
-for(k=0;k<j2 && j!=0;k++)   
-    {
+	// Continuous motion is interpolated, grid moves of the player snap
+	float py = glm::mix(prev_j5, j5, alpha);
+	float water = glm::mix(prev_wy, wy, alpha);
+	float obstacleHeight = glm::mix(prev_obsy, obsy, alpha);
 
-    Matrices.model = glm::mat4(1.0f);
-    if(j==1)
+	// Compute Camera matrix (view)
+	//  Don't change unless you are sure!!
+    if(cflag==1)
     {
-        if(flagjump==true)
-            j4=j4+0.8;
-        else
-      j4=j4+0.4;
-translateRectangle = glm::translate (glm::vec3(j4, j5, j6));
+        //tower view
+        i1=-1,i2=3,i3=3,i4=0,i5=0,i6=0,i7=0,i8=1,i9=0;
     }
-    else if(j==2)
+    else if(cflag==2)
     {
-        if(flagjump==true)
-            j4=j4-0.8;
-        else
-      j4=j4-0.4;
-translateRectangle = glm::translate (glm::vec3(j4, j5, j6));
+        //top view
+        i1=0,i2=20,i3=1,i4=0,i5=0,i6=0,i7=0,i8=1,i9=0;
     }
-    else if(j==3)
+    else if(cflag==3)
     {
-        if(flagjump==true)
-            j6=j6-0.8;
-        else
-      j6=j6-0.4;
-translateRectangle = glm::translate (glm::vec3(j4, j5, j6));
+        i1=j4;
+        i2=8;
+        i3=j6;
+        i4=j4+2;
+        i5=2;
+        i6=j6-2;
     }
-    else if(j==4)
+    else if(cflag==4)
     {
-        if(flagjump==true)
-            j6=j6+0.8;
-        else
-      j6=j6+0.4;
-
-translateRectangle = glm::translate (glm::vec3(j4, j5, j6));
+        i1=j4+1;
+        i2=py+4;
+        i3=j6-0.6;
+        i4=j4+1;
+        i5=py;
+        i6=j6-1;
     }
+    Matrices.view = glm::lookAt(glm::vec3(i1,i2,i3), glm::vec3(i4,i5,i6), glm::vec3(i7,i8,i9));
 
-    else if(j==5 && j5>2.2)
+    if(cflag1==1)
     {
-        flagjump=true;
-        
+        GLfloat radius = 2.0f;
+        GLfloat camX = sin(ct1) * radius;
+        GLfloat camZ = cos(ct1) * radius;
+        Matrices.view = glm::lookAt(glm::vec3(camX, 1.0, camZ), glm::vec3(0.0, 0.0, 0.0), glm::vec3(0.0, 1.0, 0.0));
+    }
+    else if(cflag2==1)
+    {
+        i1=j4;
+        i2=py;
+        i3=j6;
+        Matrices.view = glm::lookAt(glm::vec3(i1,i2,i3), glm::vec3(i4,i5,i6), glm::vec3(i7,i8,i9));
     }
-  //  glm::mat4 translatePlayer = glm::translate (glm::vec3(-2, 2.2, -1));        // glTranslatef
-    //glm::mat4 rotateRectangle = glm::rotate((float)(rectangle_rotation*M_PI/180.0f), glm::vec3(0,0,1)); // rotate about vector (-1,1,1)
-    Matrices.model *= (translatePlayer * rotateRectangle );
-    MVP = VP * Matrices.model;
+    else if(cflag1==3)
+    {
+        Matrices.view = glm::lookAt(glm::vec3(h1,h2,h3), glm::vec3(i4,i5,i6), glm::vec3(i7,i8,i9));
+    }
+	// Compute ViewProject matrix as view/camera might not be changed for this frame (basic scenario)
+	//  Don't change unless you are sure!!
+	glm::mat4 VP = Matrices.projection * Matrices.view;
+	Frustum frustum = frustumFromMatrix(VP);
 
-    // Copy MVP to texture shaders
-    glUniformMatrix4fv(Matrices.TexMatrixID, 1, GL_FALSE, &MVP[0][0]);
+	// Send our transformation to the currently bound shader, in the "MVP" uniform
+	// For each model you render, since the MVP will be different (at least the M part)
+	//  Don't change unless you are sure!!
+	glm::mat4 MVP;	// MVP = Projection * View * Model
 
-    // Set the texture sampler to access Texture0 memory
-    glUniform1i(glGetUniformLocation(textureProgramID, "texSampler"), 0);
+	// Load identity to model matrix
+	Matrices.model = glm::mat4(1.0f);
 
-    // draw3DObject draws the VAO given to it using current MVP matrix
-    draw3DTexturedObject(player);
-}
-if(flagjump==true)
-{
-    if(j5>2.2)
-    {
-    float uy=(5*sin(90*(PI/180)));
-        j5=  2.2 + (uy*t-5*t*t);
-        t=t+0.1;
-        translateRectangle = glm::translate (glm::vec3(j4, j5, j6));
-}
+	/* Render your scene */
+	glm::mat4 translateTriangle = glm::translate (glm::vec3(-2.0f, 0.0f, 0.0f)); // glTranslatef
+	glm::mat4 rotateTriangle = glm::rotate((float)(triangle_rotation*M_PI/180.0f), glm::vec3(0,0,1));  // rotate about vector (1,0,0)
+	glm::mat4 triangleTransform = translateTriangle * rotateTriangle;
+	Matrices.model *= triangleTransform;
+	MVP = VP * Matrices.model; // MVP = p * V * M
 
-else if(j4==ox && j6==oz)
-{
-    translateRectangle = glm::translate (glm::vec3(j4, 3.2f, j6));
-}
+	// Queue the triangle with the normal shaders and its MVP, unless it is out of view
+	if (objectVisible(frustum, triangle, Matrices.model))
+		submitDraw(colorProgram, Matrices.MatrixID, triangle, MVP);
 
-else 
-{
-    t=0;
-    j5=2.2;
-    flagjump=false;
-}
-}
+	// Render with texture shaders now
+	Matrices.model = glm::mat4(1.0f);
+	glm::mat4 translateRectangle = glm::translate (glm::vec3(0, water, -4));        // glTranslatef
+	Matrices.model *= (translateRectangle * rotateRectangle);
+	MVP = VP * Matrices.model;
 
-j=0;
-/*Matrices.model = glm::mat4(1.0f);
-//glm::mat4 translatePlayer = glm::translate (glm::vec3(-2, 2.2, -1));        // glTranslatef
-    //glm::mat4 rotateRectangle = glm::rotate((float)(rectangle_rotation*M_PI/180.0f), glm::vec3(0,0,1)); // rotate about vector (-1,1,1)
-    Matrices.model *= (translatePlayer );
-    MVP = VP * Matrices.model;
+	// Queue the background with the texture shaders and its MVP
+	if (objectVisible(frustum, rectangle, Matrices.model))
+		submitDraw(textureProgram, Matrices.TexMatrixID, rectangle, MVP);
 
-    // Copy MVP to texture shaders
-    glUniformMatrix4fv(Matrices.TexMatrixID, 1, GL_FALSE, &MVP[0][0]);
+	// The chunks in view, one instanced draw each, and the moving obstacles
+	profileBegin(PROFILE_GRID);
+	classifyGridTiles();
+	cullGridChunks(frustum, obstacleHeight);
+	updateGridChunks();
+	drawInstancedGrid(VP, obstacleHeight);
+	profileEnd(PROFILE_GRID);
 
-    // Set the texture sampler to access Texture0 memory
-    glUniform1i(glGetUniformLocation(textureProgramID, "texSampler"), 0);
+	profileBegin(PROFILE_PLAYER);
+	Matrices.model = glm::mat4(1.0f);
+	glm::mat4 translatePlayer = glm::translate (glm::vec3(j4, py, j6));        // glTranslatef
+	Matrices.model *= (translatePlayer * rotateRectangle);
+	MVP = VP * Matrices.model;
 
-    // draw3DObject draws the VAO given to it using current MVP matrix
-    draw3DTexturedObject(player);*/
+	// Queue the player with the texture shaders and its MVP
+	if (objectVisible(frustum, player, Matrices.model))
+		submitDraw(textureProgram, Matrices.TexMatrixID, player, MVP);
+	profileEnd(PROFILE_PLAYER);
 
 	// Increment angles
 	float increments = 1;
@@ -1746,8 +3662,16 @@ j=0;
 	float fontScaleValue = 0.75 + 0.25*sinf(fontScale*M_PI/180.0f);
 	glm::vec3 fontColor = getRGBfromHue (fontScale);
 
-	// Use font Shaders for next part of code
-	glUseProgram(fontProgramID);
+	// Draw everything queued above, sorted by program, texture and VAO
+	profileBegin(PROFILE_FLUSH);
+	gpuPassBegin(GPU_SCENE);
+	flushRenderQueue();
+	gpuPassEnd(GPU_SCENE);
+	profileEnd(PROFILE_FLUSH);
+
+	// HUD text, every element in one retained buffer drawn with a single call
+	profileBegin(PROFILE_FONT);
+	gpuPassBegin(GPU_FONT);
 	Matrices.view = glm::lookAt(glm::vec3(0,0,3), glm::vec3(0,0,0), glm::vec3(0,1,0)); // Fixed camera for 2D (ortho) in XY plane
     
 	// Transform the text
@@ -1756,9 +3680,6 @@ j=0;
 	glm::mat4 scaleText = glm::scale(glm::vec3(fontScaleValue,fontScaleValue,fontScaleValue));
 	Matrices.model *= (translateText * scaleText);
 	MVP = Matrices.projection * Matrices.view * Matrices.model;
-	// send font's MVP and font color to fond shaders
-	glUniformMatrix4fv(GL3Font.fontMatrixID, 1, GL_FALSE, &MVP[0][0]);
-	glUniform3fv(GL3Font.fontColorID, 1, &fontColor[0]);
     /*character time_string[2]
     time_c=timer;
     int r;
@@ -1767,70 +3688,13 @@ j=0;
     time_c/=10;
     time_string[1-i]= (char)(r + 48);
     }*/
-	// Render font
-    if(life==4)
-    {
-	GL3Font.font->Render("     lives: 4");
-}
-else if(life==3)
-    {
-    GL3Font.font->Render("     lives: 3");
-}
-else if(life==2)
-    {
-    GL3Font.font->Render("     lives: 2");
-}
-else if(life==1)
-{
-     GL3Font.font->Render("    lives: 1");
-}
-else
-{
-            textflag=(100*(levelflag-1))-(5*score);
-            if(textflag<0)
-            {
-                textflag=0;
-            }
-            cout<<"Score " << textflag<<"\n";  
-   // cout<<"Score " << (100*(levelflag-1))-(5*score)<<"\n";
-    exit(0);
-}
-    if(levelflag==1)
-    {
-        GL3Font.font->Render("                   level: 1");
-    }
-
-    else if(levelflag==2)
-        {
-            GL3Font.font->Render("                   level: 2");
-            check2();
-            speedflag=3;
-        }
-        else if(levelflag==3)
-        {
-            GL3Font.font->Render("                 level: 3");
-            
-            check3();
-            speedflag=2;
-        }
-        else if(levelflag==4)
-        {
-            GL3Font.font->Render("                 level: 4");
-            check4();
-            speedflag=1;
-        }
-        else if(levelflag==5)
-        {
-            GL3Font.font->Render("                   level: 5");
-            check5();
-            textflag=(100*levelflag)-(5*score);
-            if(textflag<0)
-            {
-                textflag=0;
-            }
-            cout<<"Score " << textflag<<"\n";  
-            exit(0);
-        }
+	// The text is only laid out again when lives, level or color change
+	setHudElement(HUD_LIVES, life, fontColor);
+	setHudElement(HUD_LEVEL, levelflag, fontColor);
+	updateHud();
+	drawHud(MVP);
+	gpuPassEnd(GPU_FONT);
+	profileEnd(PROFILE_FONT);
 
 	//camera_rotation_angle++; // Simulating camera rotation
 	//triangle_rotation = triangle_rotation + increments*triangle_rot_dir*triangle_rot_status;
@@ -1840,6 +3704,14 @@ else
 	//fontScale = (fontScale + 1) % 360;
 }
 
+/* Number of vertical blanks to wait for per frame, 0 renders uncapped */
+int swapInterval = 1;
+
+/* Benchmark mode : seeded board, scripted input, exactly one simulation step per frame
+ * in a hidden uncapped window, so two builds render the same sequence of frames */
+int benchmarkFrames = 0; // 0 plays the game normally
+unsigned benchmarkSeed = 1;
+
 /* Initialise glfw window, I/O callbacks and the renderer to use */
 /* Nothing to Edit here */
 GLFWwindow* initGLFW (int width, int height)
@@ -1856,6 +3728,10 @@ GLFWwindow* initGLFW (int width, int height)
 	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
 	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
+	// Benchmarks render into a hidden window
+	if (benchmarkFrames > 0)
+		glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
+
 	window = glfwCreateWindow(width, height, "Sample OpenGL 3.3 Application", NULL, NULL);
 
 	if (!window) {
@@ -1865,7 +3741,7 @@ GLFWwindow* initGLFW (int width, int height)
 
 	glfwMakeContextCurrent(window);
 	gladLoadGLLoader((GLADloadproc) glfwGetProcAddress);
-	glfwSwapInterval( 1 );
+	glfwSwapInterval( swapInterval );
 
 	/* --- register callbacks with GLFW --- */
 
@@ -1888,42 +3764,414 @@ GLFWwindow* initGLFW (int width, int height)
 	return window;
 }
 
+/* Offscreen rendering : draw() goes into a framebuffer object of any size instead of
+ * the window. With USE_EGL the context is a surfaceless EGL one (Mesa llvmpipe works
+ * on machines without a GPU or display), otherwise it comes from a hidden GLFW window. */
+struct OffscreenTarget {
+	bool enabled;
+	int width, height;
+	GLuint framebuffer, colorBuffer, depthBuffer;
+	const char* dumpDir; // NULL when frames are not saved
+	int dumpEvery;
+	vector<unsigned char> pixels;
+} offscreen = { false, 1800, 1000, 0, 0, 0, NULL, 60 };
+
+#ifdef USE_EGL
+/* Surfaceless EGL display and desktop GL 3.3 core context, no window system needed */
+bool initEGLContext ()
+{
+	EGLDisplay display = EGL_NO_DISPLAY;
+	PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+		(PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress("eglGetPlatformDisplayEXT");
+	if (getPlatformDisplay)
+		display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+	if (display == EGL_NO_DISPLAY)
+		display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+	EGLint major, minor;
+	if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor)) {
+		cout << "EGL: no display" << endl;
+		return false;
+	}
+	if (!eglBindAPI(EGL_OPENGL_API)) {
+		cout << "EGL: desktop OpenGL not supported" << endl;
+		return false;
+	}
+
+	// No surface is ever created, the config only has to allow a GL context
+	const EGLint configAttribs[] = { EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE };
+	EGLConfig config = 0;
+	EGLint numConfigs = 0;
+	eglChooseConfig(display, configAttribs, &config, 1, &numConfigs);
+
+	const EGLint contextAttribs[] = {
+		EGL_CONTEXT_MAJOR_VERSION, 3,
+		EGL_CONTEXT_MINOR_VERSION, 3,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+		EGL_NONE
+	};
+	EGLContext context = eglCreateContext(display, numConfigs ? config : (EGLConfig) 0, EGL_NO_CONTEXT, contextAttribs);
+	if (context == EGL_NO_CONTEXT || !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+		cout << "EGL: could not create a surfaceless OpenGL 3.3 context (error 0x" << hex << eglGetError() << dec << ")" << endl;
+		return false;
+	}
+
+	gladLoadGLLoader((GLADloadproc) eglGetProcAddress);
+	cout << "EGL " << major << "." << minor << ": " << glGetString(GL_RENDERER) << ", " << glGetString(GL_VERSION) << endl;
+	return true;
+}
+#endif
+
+/* Context for offscreen rendering, returns the hidden window or NULL for EGL */
+GLFWwindow* initOffscreenContext (int width, int height)
+{
+#ifdef USE_EGL
+	if (!initEGLContext())
+		exit(EXIT_FAILURE);
+	return NULL;
+#else
+	return initGLFW(width, height);
+#endif
+}
+
+/* Colour and depth renderbuffers at the offscreen resolution, left bound for draw() */
+void createOffscreenTarget ()
+{
+	glGenFramebuffers(1, &offscreen.framebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, offscreen.framebuffer);
+
+	glGenRenderbuffers(1, &offscreen.colorBuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, offscreen.colorBuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, offscreen.width, offscreen.height);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, offscreen.colorBuffer);
+
+	glGenRenderbuffers(1, &offscreen.depthBuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, offscreen.depthBuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, offscreen.width, offscreen.height);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, offscreen.depthBuffer);
+
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+		cout << "Offscreen framebuffer is incomplete" << endl;
+		exit(EXIT_FAILURE);
+	}
+	reshapeWindow(NULL, offscreen.width, offscreen.height);
+
+	if (offscreen.dumpDir)
+		mkdir(offscreen.dumpDir, 0755); // fails harmlessly if it exists
+}
+
+/* Save the offscreen colour buffer as a binary PPM, DIR/frame_NNNNN.ppm */
+void dumpFrame (int frame)
+{
+	int w = offscreen.width, h = offscreen.height;
+	offscreen.pixels.resize(w*h*3);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(0, 0, w, h, GL_RGB, GL_UNSIGNED_BYTE, &offscreen.pixels[0]);
+
+	char path[512];
+	snprintf(path, sizeof(path), "%s/frame_%05d.ppm", offscreen.dumpDir, frame);
+	ofstream out(path, ios::binary);
+	if (!out.is_open()) {
+		cout << "Could not write " << path << endl;
+		return;
+	}
+	out << "P6\n" << w << " " << h << "\n255\n";
+	// GL rows start at the bottom, PPM rows at the top
+	for (int y=h-1; y>=0; y--)
+		out.write((const char*) &offscreen.pixels[y*w*3], w*3);
+}
+
+/* Asset loader : images, sounds and the font are read and decoded on worker threads while
+ * the window already shows frames. What needs the GL context (the texture and glyph
+ * atlas uploads) is finished on the main thread by pollAssets. */
+enum AssetKind {
+	ASSET_TEXTURE, // cooked into layer 'index' of the texture array
+	ASSET_SOUND,   // decoded into 'buffer', which the voices play
+	ASSET_MUSIC,   // mapped by 'music', which streams it while playing
+	ASSET_FONT     // baked into 'atlas', the HUD draws its glyphs
+};
+
+struct Asset {
+	const char* filename;
+	AssetKind kind;
+	int index;
+	sf::SoundBuffer* buffer;
+	MappedWavStream* music;
+	bool ok, cookedNow;
+	size_t bytes;              // size once decoded
+	double decodeMs, uploadMs; // worker thread, main thread
+	CookedTexture texture;
+	GlyphAtlas atlas;
+};
+
+struct AssetLoader {
+	vector<Asset> assets;      // filled before the workers start, never resized after
+	vector<thread> workers;
+	int threads;
+	mutex lock;                // guards queued, decoded and stop
+	condition_variable work;   // queued gained an asset, or stop was set
+	condition_variable done;   // decoded gained an asset
+	deque<int> queued;         // waiting for a worker
+	deque<int> decoded;        // waiting for pollAssets
+	bool stop;
+	int remaining;             // not finished by pollAssets yet
+	GLuint textureArray;
+	double startTime, firstFrameTime, doneTime;
+} loader;
+
+/* Read and decode one asset, on a worker thread */
+void decodeAsset (Asset& asset)
+{
+	double start = getTime();
+	if (asset.kind == ASSET_TEXTURE) {
+		asset.ok = loadCookedTexture(asset.filename, TEXTURE_LAYER_SIZE, asset.texture, asset.cookedNow);
+		asset.bytes = asset.texture.file.size();
+	}
+	else if (asset.kind == ASSET_SOUND) {
+		const unsigned char* data;
+		size_t size;
+		vector<unsigned char> storage;
+		asset.ok = readAssetFile(asset.filename, data, size, storage) && asset.buffer->loadFromMemory(data, size);
+		asset.bytes = asset.buffer->getSampleCount() * sizeof(sf::Int16);
+	}
+	else if (asset.kind == ASSET_MUSIC) {
+		asset.ok = asset.music->open(asset.filename);
+		asset.bytes = asset.music->residentBytes();
+	}
+	else {
+		asset.ok = loadGlyphAtlas(asset.filename, GLYPH_PIXEL_SIZE, asset.atlas, asset.cookedNow);
+		asset.bytes = asset.atlas.file.size();
+	}
+	asset.decodeMs = (getTime() - start) * 1000.0;
+}
+
+void assetWorker ()
+{
+	unique_lock<mutex> guard(loader.lock);
+	while (true) {
+		while (loader.queued.empty() && !loader.stop)
+			loader.work.wait(guard);
+		if (loader.stop)
+			return;
+		int i = loader.queued.front();
+		loader.queued.pop_front();
+
+		guard.unlock();
+		decodeAsset(loader.assets[i]);
+		guard.lock();
+
+		loader.decoded.push_back(i);
+		loader.done.notify_one();
+	}
+}
+
+/* Let the workers finish the asset they are on and join them, safe to call twice */
+void stopAssetLoader ()
+{
+	{
+		lock_guard<mutex> guard(loader.lock);
+		loader.stop = true;
+	}
+	loader.work.notify_all();
+	for (size_t t=0; t<loader.workers.size(); t++)
+		loader.workers[t].join();
+	loader.workers.clear();
+}
+
+void addAsset (const char* filename, AssetKind kind, int index, sf::SoundBuffer* buffer=NULL, MappedWavStream* music=NULL)
+{
+	Asset asset;
+	asset.filename = filename;
+	asset.kind = kind;
+	asset.index = index;
+	asset.buffer = buffer;
+	asset.music = music;
+	asset.ok = asset.cookedNow = false;
+	asset.bytes = 0;
+	asset.decodeMs = asset.uploadMs = 0;
+	loader.assets.push_back(asset);
+}
+
+/* Queue every asset of the game and start the workers, the texture array receives the images */
+void startAssetLoading (GLuint textureArray)
+{
+	loader.startTime = getTime();
+	loader.firstFrameTime = loader.doneTime = 0;
+	loader.textureArray = textureArray;
+	loader.stop = false;
+
+	addAsset("my.wav", ASSET_MUSIC, 0, NULL, &musicTracks[MUSIC_BACKGROUND]);
+	addAsset("lvl.wav", ASSET_MUSIC, 0, NULL, &musicTracks[MUSIC_LEVEL_UP]);
+	addAsset("bg2.jpg", ASSET_TEXTURE, LAYER_BACKGROUND);
+	addAsset("cube2.jpg", ASSET_TEXTURE, LAYER_TILE);
+	addAsset("cube.bmp", ASSET_TEXTURE, LAYER_PLAYER);
+	addAsset("arial.ttf", ASSET_FONT, 0);
+	addAsset("jump.wav", ASSET_SOUND, 0, &effectBuffers[SFX_JUMP]);
+	addAsset("walk.wav", ASSET_SOUND, 0, &effectBuffers[SFX_WALK]);
+	addAsset("final.wav", ASSET_SOUND, 0, &effectBuffers[SFX_WIN]);
+	addAsset("hole.wav", ASSET_SOUND, 0, &effectBuffers[SFX_FALL]);
+	addAsset("obstac.wav", ASSET_SOUND, 0, &effectBuffers[SFX_OBSTACLE]);
+	loader.remaining = loader.assets.size();
+	for (size_t i=0; i<loader.assets.size(); i++)
+		loader.queued.push_back(i);
+
+	// The main thread keeps compiling shaders and drawing frames meanwhile
+	loader.threads = min(4, max(1, (int) thread::hardware_concurrency() - 1));
+	for (int t=0; t<loader.threads; t++)
+		loader.workers.push_back(thread(assetWorker));
+}
+
+/* Main thread half of loading an asset : GL uploads */
+void finishAsset (Asset& asset)
+{
+	double start = getTime();
+	if (!asset.ok) {
+		cout << "Could not load " << asset.filename << endl;
+		// A missing texture only leaves its layer blank, the audio and font are required
+		if (asset.kind == ASSET_TEXTURE)
+			return;
+		stopAssetLoader();
+		glfwTerminate();
+		exit(EXIT_FAILURE);
+	}
+
+	if (asset.kind == ASSET_TEXTURE) {
+		glBindTexture(GL_TEXTURE_2D_ARRAY, loader.textureArray);
+		uploadCookedLayer(asset.texture, asset.index);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+		invalidateGLState();
+		vector<unsigned char>().swap(asset.texture.file); // the texels live on the GPU now
+	}
+	else if (asset.kind == ASSET_FONT) {
+		createGlyphAtlasTexture(asset.atlas);
+		vector<unsigned char>().swap(asset.atlas.file);
+	}
+	asset.uploadMs = (getTime() - start) * 1000.0;
+
+	if (asset.kind == ASSET_TEXTURE) {
+		textureStats.textures++;
+		textureStats.cooked += asset.cookedNow;
+		textureStats.bytesRead += asset.bytes;
+		textureStats.ms += asset.decodeMs + asset.uploadMs;
+	}
+}
+
+void printAssetReport ()
+{
+	char line[160];
+	const char* kinds[] = { "texture", "sound", "music", "font" };
+	double decodeMs = 0, uploadMs = 0, audioMs = 0;
+	size_t audioBytes = 0, bufferedBytes = 0; // resident now, resident with every track in a SoundBuffer
+	for (size_t i=0; i<loader.assets.size(); i++) {
+		const Asset& asset = loader.assets[i];
+		snprintf(line, sizeof(line), "  %-12s %-8s %8.1f KB  decode %7.1f ms  main thread %6.1f ms",
+				 asset.filename, kinds[asset.kind], asset.bytes / 1024.0, asset.decodeMs, asset.uploadMs);
+		cout << line << endl;
+		decodeMs += asset.decodeMs;
+		uploadMs += asset.uploadMs;
+		if (asset.kind == ASSET_SOUND || asset.kind == ASSET_MUSIC) {
+			audioMs += asset.decodeMs;
+			audioBytes += asset.bytes;
+			bufferedBytes += asset.kind == ASSET_MUSIC ? asset.music->decodedBytes() : asset.bytes;
+		}
+	}
+	snprintf(line, sizeof(line), "Assets: %d loaded by %d worker threads in %.1f ms (%.1f ms decoding, %.1f ms on the main thread)",
+			 (int) loader.assets.size(), loader.threads, (loader.doneTime - loader.startTime) * 1000.0, decodeMs, uploadMs);
+	cout << line << endl;
+	if (loader.firstFrameTime > 0) {
+		snprintf(line, sizeof(line), "Assets: first frame shown %.1f ms after loading started",
+				 (loader.firstFrameTime - loader.startTime) * 1000.0);
+		cout << line << endl;
+	}
+	if (assetPack.data)
+		snprintf(line, sizeof(line), "Asset pack: %u files, %.1f KB mapped, %d reads served from it, %d loose files opened",
+				 assetPack.count, assetPack.size / 1024.0, (int) assetPack.served, (int) assetPack.looseFiles);
+	else
+		snprintf(line, sizeof(line), "Asset pack: none, %d loose files opened (make assets.pak builds one)", (int) assetPack.looseFiles);
+	cout << line << endl;
+	snprintf(line, sizeof(line), "Audio: %.1f KB resident, %.1f KB with the tracks decoded into sound buffers (%.1fx smaller), %.1f ms loading",
+			 audioBytes / 1024.0, bufferedBytes / 1024.0, (double) bufferedBytes / max((size_t) 1, audioBytes), audioMs);
+	cout << line << endl;
+	for (size_t i=0; i<loader.assets.size(); i++)
+		if (loader.assets[i].kind == ASSET_FONT) {
+			snprintf(line, sizeof(line), "Glyph atlas: %d glyphs at %d px in %dx%d, %s",
+					 (int) hud.glyphs.size(), (int) hud.pixelSize, (int) hud.atlasWidth, (int) hud.atlasHeight,
+					 loader.assets[i].cookedNow ? "baked this launch" : "read from the cache");
+			cout << line << endl;
+		}
+	printTextureStartupReport();
+}
+
+/* Finish assets the workers have decoded : one per call, so frames keep coming while
+ * loading, or all of them when 'wait' is set. True once every asset is loaded. */
+bool pollAssets (bool wait)
+{
+	while (loader.remaining > 0) {
+		int i;
+		{
+			unique_lock<mutex> guard(loader.lock);
+			while (wait && loader.decoded.empty())
+				loader.done.wait(guard);
+			if (loader.decoded.empty())
+				return false;
+			i = loader.decoded.front();
+			loader.decoded.pop_front();
+		}
+		finishAsset(loader.assets[i]);
+
+		if (--loader.remaining == 0) {
+			loader.doneTime = getTime();
+			stopAssetLoader();
+			printAssetReport();
+		}
+		else if (!wait)
+			return false;
+	}
+	return true;
+}
+
 /* Initialize the OpenGL rendering properties */
 /* Add all the models to be created here */
 void initGL (GLFWwindow* window, int width, int height)
 {
+	// Start building every program up front : they compile in parallel where the driver
+	// supports it, and come straight from the binary cache after the first launch
+	enableParallelShaderCompile();
+
 	// Load Textures
 	// Enable Texture0 as current texture memory
 	glActiveTexture(GL_TEXTURE0);
-	// load an image file directly as a new OpenGL texture
-	// GLuint texID = SOIL_load_OGL_texture ("beach.png", SOIL_LOAD_AUTO, SOIL_CREATE_NEW_ID, SOIL_FLAG_TEXTURE_REPEATS); // Buggy for OpenGL3
-	GLuint textureID = createTexture("bg2.jpg");
-    GLuint textureID1= createTexture("cube2.jpg");
-    GLuint textureID2= createTexture("cube.bmp");
-	// check for an error during the load process
-	if(textureID == 0 )
-		cout << "SOIL loading error: '" << SOIL_last_result() << "'" << endl;
+	// Images, sounds and the font decode on worker threads, pollAssets finishes them
+	textureEncoding = chooseTextureEncoding();
+	GLuint textureID = createTextureArray(TEXTURE_LAYERS);
+	startAssetLoading(textureID);
+
+	PendingProgram texturePending = beginShaderProgram( "TextureRender.vert", "TextureRender.frag" );
+	PendingProgram gridPending = beginShaderProgram( "GridInstanced.vert", "TextureRender.frag" );
+	PendingProgram colorPending = beginShaderProgram( "Sample_GL3.vert", "Sample_GL3.frag" );
+	PendingProgram fontPending = beginShaderProgram( "fontrender.vert", "fontrender.frag" );
 
 	// Create and compile our GLSL program from the texture shaders
-	textureProgramID = LoadShaders( "TextureRender.vert", "TextureRender.frag" );
-	// Get a handle for our "MVP" uniform
-	Matrices.TexMatrixID = glGetUniformLocation(textureProgramID, "MVP");
+	textureProgram = createShaderProgram( texturePending );
+	// Get a handle for our "MVP" and "texSampler" uniforms
+	Matrices.TexMatrixID = textureProgram.uniform("MVP");
+	Matrices.TexSamplerID = textureProgram.uniform("texSampler");
 
 
 	/* Objects should be created before any other gl function and shaders */
 	// Create the models
 	createTriangle (); // Generate the VAO, VBOs, vertices data & copy into the array buffer
-	createRectangle (textureID);
-    createPlayer(textureID2);
-    int i;
-    for(i=0;i<100;i++)
-	createCube(textureID1,i);
+	createRectangle (textureID, LAYER_BACKGROUND);
+    createPlayer(textureID, LAYER_PLAYER);
+	createCube(textureID, LAYER_TILE);
+	createInstancedGrid(cube, boardTiles(), createShaderProgram( gridPending ));
+	printMeshRegistryReport();
 
 
 	// Create and compile our GLSL program from the shaders
-	programID = LoadShaders( "Sample_GL3.vert", "Sample_GL3.frag" );
+	colorProgram = createShaderProgram( colorPending );
 	// Get a handle for our "MVP" uniform
-	Matrices.MatrixID = glGetUniformLocation(programID, "MVP");
+	Matrices.MatrixID = colorProgram.uniform("MVP");
 
 
 	reshapeWindow (window, width, height);
@@ -1937,31 +4185,16 @@ void initGL (GLFWwindow* window, int width, int height)
 	//glEnable(GL_BLEND);
 	//glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-	// Initialise FTGL stuff
-	const char* fontfile = "arial.ttf";
-	GL3Font.font = new FTExtrudeFont(fontfile); // 3D extrude style rendering
-
-	if(GL3Font.font->Error())
-	{
-		cout << "Error: Could not load font `" << fontfile << "'" << endl;
-		glfwTerminate();
-		exit(EXIT_FAILURE);
-	}
+	// Create and compile our GLSL program from the font shaders, the glyph atlas itself
+	// is baked by the asset loader
+	fontProgram = createShaderProgram( fontPending );
+	printShaderStartupReport();
+	createHudBatch();
 
-	// Create and compile our GLSL program from the font shaders
-	fontProgramID = LoadShaders( "fontrender.vert", "fontrender.frag" );
-	GLint fontVertexCoordAttrib, fontVertexNormalAttrib, fontVertexOffsetUniform;
-	fontVertexCoordAttrib = glGetAttribLocation(fontProgramID, "vertexPosition");
-	fontVertexNormalAttrib = glGetAttribLocation(fontProgramID, "vertexNormal");
-	fontVertexOffsetUniform = glGetUniformLocation(fontProgramID, "pen");
-	GL3Font.fontMatrixID = glGetUniformLocation(fontProgramID, "MVP");
-	GL3Font.fontColorID = glGetUniformLocation(fontProgramID, "fontColor");
-
-	GL3Font.font->ShaderLocations(fontVertexCoordAttrib, fontVertexNormalAttrib, fontVertexOffsetUniform);
-	GL3Font.font->FaceSize(1);
-	GL3Font.font->Depth(0);
-	GL3Font.font->Outset(0, 0);
-	GL3Font.font->CharMap(ft_encoding_unicode);
+	// Texture unit 0 never changes, upload the sampler once
+	useProgram(textureProgram.ProgramID);
+	textureProgram.setInt(Matrices.TexSamplerID, 0);
+	invalidateGLState();
 
 	cout << "VENDOR: " << glGetString(GL_VENDOR) << endl;
 	cout << "RENDERER: " << glGetString(GL_RENDERER) << endl;
@@ -1970,42 +4203,220 @@ void initGL (GLFWwindow* window, int width, int height)
 
 }
 
+/* Play sounds and print messages for what happened in the last simulation step */
+void playSimEvents ()
+{
+	if (simEvents & SIM_EVENT_FALL)
+		playEffect(SFX_FALL);
+	if (simEvents & SIM_EVENT_OBSTACLE)
+		playEffect(SFX_OBSTACLE);
+	if (simEvents & SIM_EVENT_LEVEL_UP) {
+		cout << "You win \n";
+		cout << "Level " << levelflag << " \n";
+		playMusic(MUSIC_LEVEL_UP);
+	}
+	if (simEvents & SIM_EVENT_WIN) {
+		cout << "You win \n";
+		playEffect(SFX_WIN);
+	}
+	simEvents = 0;
+
+	if (gameEnded) {
+		cout << "Score " << finalScore << "\n";
+		stopAudio();
+		exit(0);
+	}
+}
+
+/* Fingerprint of the simulation state, compared across builds to prove the frames match */
+uint64_t hashSimState (uint64_t seed)
+{
+	float values[5] = { j4, j5, j6, wy, obsy };
+	int counters[4] = { levelflag, life, score, cflag };
+	seed = hashBytes(values, sizeof(values), seed);
+	seed = hashBytes(counters, sizeof(counters), seed);
+	seed = hashBytes(&obstacleTiles.bits[0], obstacleTiles.bits.size()*sizeof(uint64_t), seed);
+	return hashBytes(&holeTiles.bits[0], holeTiles.bits.size()*sizeof(uint64_t), seed);
+}
+
+double percentile (const vector<double>& sorted, double p)
+{
+	return sorted[min(sorted.size()-1, (size_t) (p*sorted.size()))];
+}
+
+void runBenchmark (GLFWwindow* window)
+{
+	vector<double> frameMs;
+	frameMs.reserve(benchmarkFrames);
+	long long drawCalls = 0, stateRequested = 0, stateIssued = 0;
+	uint64_t sequenceHash = 14695981039346656037ULL;
+	size_t nextKey = 0;
+	int games = 0;
+
+	for (int frame=0; frame<benchmarkFrames; frame++) {
+		double frameStart = getTime();
+		profileBegin(PROFILE_FRAME);
+
+		while (nextKey < inputScript.size() && inputScript[nextKey].step <= simStep)
+			keyboard(window, inputScript[nextKey++].key, 0, GLFW_RELEASE, 0);
+
+		profileBegin(PROFILE_SIMULATE);
+		simulate();
+		stepCamera();
+		simStep++;
+		simEvents = 0;
+		if (gameEnded) {
+			games++;
+			resetGame();
+		}
+		profileEnd(PROFILE_SIMULATE);
+
+		draw(0);
+		glFinish(); // wait for the GPU, so the frame time covers the whole frame
+		profileEnd(PROFILE_FRAME);
+		endProfilerFrame(); // --profile rows line up with the benchmark frames
+
+		frameMs.push_back((getTime() - frameStart) * 1000.0);
+		drawCalls += glState.draws;
+		stateRequested += glState.requested;
+		stateIssued += glState.issued;
+		endGLStateFrame();
+		sequenceHash = hashSimState(sequenceHash);
+
+		if (offscreen.enabled) {
+			if (offscreen.dumpDir && frame % offscreen.dumpEvery == 0)
+				dumpFrame(frame);
+		}
+		else
+			glfwSwapBuffers(window);
+		if (window)
+			glfwPollEvents();
+	}
+
+	vector<double> sorted = frameMs;
+	sort(sorted.begin(), sorted.end());
+	double total = 0;
+	for (size_t f=0; f<sorted.size(); f++)
+		total += sorted[f];
+
+	char line[160];
+	cout << "Benchmark: " << benchmarkFrames << " frames on a " << board.cols << "x" << board.rows << " board, seed " << benchmarkSeed << ", "
+		 << inputScript.size() << " scripted keys, " << games << " games finished" << endl;
+	snprintf(line, sizeof(line), "Frame time (ms): min %.3f  p50 %.3f  p90 %.3f  p99 %.3f  max %.3f  avg %.3f",
+			 sorted.front(), percentile(sorted, 0.5), percentile(sorted, 0.9), percentile(sorted, 0.99),
+			 sorted.back(), total / sorted.size());
+	cout << line << endl;
+	snprintf(line, sizeof(line), "Per frame: %.1f draw calls, %.1f state changes issued, %.1f removed by the cache",
+			 (double) drawCalls / benchmarkFrames, (double) stateIssued / benchmarkFrames,
+			 (double) (stateRequested - stateIssued) / benchmarkFrames);
+	cout << line << endl;
+	snprintf(line, sizeof(line), "Culling: %.1f of %.1f tiles and %.1f of %.1f other objects drawn per frame",
+			 (double) cullStats.tilesDrawn / benchmarkFrames, (double) cullStats.tilesTested / benchmarkFrames,
+			 (double) cullStats.objectsDrawn / benchmarkFrames, (double) cullStats.objectsTested / benchmarkFrames);
+	cout << line << endl;
+	snprintf(line, sizeof(line), "Grid: %lld chunk buffers baked for %d chunks of %dx%d tiles",
+			 grid.bakes, (int) grid.chunks.size(), GRID_CHUNK, GRID_CHUNK);
+	cout << line << endl;
+	snprintf(line, sizeof(line), "HUD: %d text layouts and %d buffer uploads in %d frames",
+			 hud.layouts, hud.uploads, benchmarkFrames);
+	cout << line << endl;
+	snprintf(line, sizeof(line), "Frame sequence hash: %016llx", (unsigned long long) sequenceHash);
+	cout << line << endl;
+	if (profiler.enabled)
+		printProfileSummary();
+}
+
 int main (int argc, char** argv)
 {
 	int width = 1800;
 	int height = 1000;
 
-	GLFWwindow* window = initGLFW(width, height);
+	// --uncapped renders as fast as possible, --swap-interval=N waits N vblanks per frame
+	// --profile[=FILE] writes per-frame timings to FILE (profile.csv by default)
+	// --benchmark=N renders N scripted frames offscreen, see runBenchmark
+	const char* profilePath = NULL;
+	const char* scriptPath = NULL;
+	for (int a=1; a<argc; a++) {
+		if (strcmp(argv[a], "--uncapped") == 0)
+			swapInterval = 0;
+		else if (strncmp(argv[a], "--swap-interval=", 16) == 0)
+			swapInterval = atoi(argv[a] + 16);
+		else if (strcmp(argv[a], "--profile") == 0)
+			profilePath = "profile.csv";
+		else if (strncmp(argv[a], "--profile=", 10) == 0)
+			profilePath = argv[a] + 10;
+		else if (strncmp(argv[a], "--benchmark=", 12) == 0)
+			benchmarkFrames = atoi(argv[a] + 12);
+		else if (strncmp(argv[a], "--seed=", 7) == 0)
+			benchmarkSeed = strtoul(argv[a] + 7, NULL, 10);
+		else if (strncmp(argv[a], "--script=", 9) == 0)
+			scriptPath = argv[a] + 9;
+		else if (strncmp(argv[a], "--record=", 9) == 0)
+			inputRecording.open(argv[a] + 9);
+		else if (strncmp(argv[a], "--offscreen", 11) == 0) {
+			offscreen.enabled = true;
+			sscanf(argv[a] + 11, "=%dx%d", &offscreen.width, &offscreen.height);
+		}
+		else if (strncmp(argv[a], "--dump=", 7) == 0)
+			offscreen.dumpDir = argv[a] + 7;
+		else if (strcmp(argv[a], "--texture-format=rgb") == 0)
+			textureEncoding = TEXTURE_RGB;
+		else if (strcmp(argv[a], "--texture-format=bc1") == 0)
+			textureEncoding = TEXTURE_BC1;
+		else if (strcmp(argv[a], "--texture-format=etc2") == 0)
+			textureEncoding = TEXTURE_ETC2;
+		else if (strcmp(argv[a], "--no-shader-cache") == 0)
+			shaderCacheEnabled = false;
+		else if (strncmp(argv[a], "--dump-every=", 13) == 0)
+			offscreen.dumpEvery = max(1, atoi(argv[a] + 13));
+		else if (strncmp(argv[a], "--board=", 8) == 0) {
+			int cols = 10, rows = 10;
+			sscanf(argv[a] + 8, "%dx%d", &cols, &rows);
+			setBoard(cols, rows, board.pitch, board.originX, board.originZ);
+		}
+	}
+	// Offscreen runs are benchmarks, there is no window to play in
+	if (offscreen.enabled && benchmarkFrames <= 0)
+		benchmarkFrames = 600;
+	if (scriptPath && !loadInputScript(scriptPath))
+		return -1;
+	if (benchmarkFrames > 0)
+		swapInterval = 0;
+
+	// Assets come from assets.pak, loose files are the fallback
+	findAssetPack();
+
+	GLFWwindow* window;
+	if (offscreen.enabled) {
+		window = initOffscreenContext(width, height);
+		initGL (window, offscreen.width, offscreen.height);
+		createOffscreenTarget();
+	}
+	else {
+		window = initGLFW(width, height);
+		initGL (window, width, height);
+	}
 
-	initGL (window, width, height);
+	if (profilePath)
+		initProfiler(profilePath);
+
+	if (benchmarkFrames > 0) {
+		// Every frame of a benchmark draws with all assets in place
+		pollAssets(true);
+		// Same board for every run
+		srand(benchmarkSeed);
+		resetGame();
+		runBenchmark(window);
+		stopAssetLoader();
+		if (window)
+			glfwTerminate();
+		exit(EXIT_SUCCESS);
+	}
+
+	double previous_time = getTime(), current_time;
+	double accumulator = 0;
+	resetGame();
 
-	double last_update_time = glfwGetTime(), current_time;
-    for(int c=0;c<m;c++)
-            {
-                num[c]=rand()%98+0;
-            }
-
-    if(!buffer1.loadFromFile("my.wav"))
-    return -1;
-    sound1.setBuffer(buffer1);   
-     if(!buffer2.loadFromFile("jump.wav"))
-    return -1;
-    sound2.setBuffer(buffer2);    
-    if(!buffer3.loadFromFile("walk.wav"))
-    return -1;
-    sound3.setBuffer(buffer3);   
-    if(!buffer4.loadFromFile("final.wav"))
-    return -1;
-    sound4.setBuffer(buffer4);
-    if(!buffer5.loadFromFile("lvl.wav"))
-    return -1;
-    sound5.setBuffer(buffer5);
-    if(!buffer6.loadFromFile("hole.wav"))
-    return -1;
-    sound6.setBuffer(buffer6);
-    if(!buffer7.loadFromFile("obstac.wav"))
-    return -1;
-    sound7.setBuffer(buffer7);
 /*
     glfwGetCursorPos(window, &xpos, &ypos);
     double xpos1=xpos;
@@ -2016,11 +4427,24 @@ int main (int argc, char** argv)
     double xpos1=xpos;
     double ypos1=ypos;  
 
+	// Loading screen : frames show the clear colour until the workers are done
+	while (!glfwWindowShouldClose(window) && !pollAssets(false)) {
+		glClear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		glfwSwapBuffers(window);
+		if (loader.firstFrameTime == 0)
+			loader.firstFrameTime = getTime();
+		glfwPollEvents();
+	}
+	previous_time = getTime();
+	startAudio();
+
 	/* Draw in loop */
-    sound1.play();
+    playMusic(MUSIC_BACKGROUND);
 
  
 	while (!glfwWindowShouldClose(window)) {
+		profileBegin(PROFILE_FRAME);
+		profileBegin(PROFILE_INPUT);
       //  if(cflag==1)
         {
             glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
@@ -2043,57 +4467,49 @@ int main (int argc, char** argv)
 }
 
         glfwSetScrollCallback(window, scroll_callback);
-		// OpenGL Draw commands
-		draw();
+		profileEnd(PROFILE_INPUT);
+
+		// Run as many fixed simulation steps as real time has passed
+		profileBegin(PROFILE_SIMULATE);
+		current_time = getTime(); // Time in seconds
+		// Clamp long stalls so the game does not fast-forward after a hitch
+		accumulator += min(current_time - previous_time, 0.25);
+		previous_time = current_time;
+		while (accumulator >= SIM_DT) {
+			simulate();
+			stepCamera();
+			simStep++;
+			playSimEvents();
+			accumulator -= SIM_DT;
+		}
+		profileEnd(PROFILE_SIMULATE);
+
+		// OpenGL Draw commands, blended between the last two simulation steps
+		draw(accumulator / SIM_DT);
+		endGLStateFrame();
 
 		// Swap Frame Buffer in double buffering
+		profileBegin(PROFILE_SWAP);
 		glfwSwapBuffers(window);
+		profileEnd(PROFILE_SWAP);
 
 		// Poll for Keyboard and mouse events
+		profileBegin(PROFILE_INPUT);
 		glfwPollEvents();
 
              glfwGetCursorPos(window, &xpos, &ypos);
 
     double xpos1=xpos;
     double ypos1=ypos; 
+		profileEnd(PROFILE_INPUT);
 
-		// Control based on time (Time based transformation like 5 degrees rotation every 0.5s)
-		current_time = glfwGetTime(); // Time in seconds
-		if ((current_time - last_update_time) >= speedflag) { // atleast 0.5s elapsed since last frame
-			// do something every 0.5 seconds ..
-            for(int c=0;c<m;c++)
-            {
-                num[c]=rand()%98+0;
-                hole(num[c]);
-                if(num[c]%10==0)
-                {
-                    num[c]=98;
-                }
-                else if(hx1==j4 && hz1==j6)
-                {
-                    num[c]=84;
-                }
-            }
-            for(int c=0;c<10;c++)
-            {
-               
-                num1[c]=rand()%98+0;
-                if(num1[c]%10==0)
-                {
-                    num1[c]=98;
-                }
-                else if(hx1==j4 && hz1==j6)
-                {
-                    num1[c]=84;
-                }
-            
-            }
+		profileEnd(PROFILE_FRAME);
+		endProfilerFrame();
 
-			last_update_time = current_time;
-		}
 	}
 
-
+	stopAudio();
+	stopAssetLoader();
 	glfwTerminate();
 	exit(EXIT_SUCCESS);
 }
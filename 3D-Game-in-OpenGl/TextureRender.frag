@@ -1,13 +1,13 @@
 #version 330 core
 
 // Interpolated values from the vertex shaders
-in vec2 fragTexCoord;
+in vec3 fragTexCoord; // texture coords and array layer
 
 // output data
 out vec3 color;
 
-// Texture sample for the whole mesh
-uniform sampler2D texSampler;
+// Texture array shared by every textured mesh
+uniform sampler2DArray texSampler;
 
 void main()
 {
@@ -3,19 +3,20 @@
 // input data : sent from main program
 layout (location = 0) in vec3 vertexPosition;
 layout (location = 2) in vec2 vertexTexCoord;
+layout (location = 4) in float textureLayer;
 
 uniform mat4 MVP;
 
 // output data : used by fragment shader
-out vec2 fragTexCoord;
+out vec3 fragTexCoord;
 
 void main ()
 {
     vec4 v = vec4(vertexPosition, 1); // Transform an homogeneous 4D vector
 
     // The texture coord of each vertex will be interpolated
-    // to produce the color of each fragment
-    fragTexCoord = vertexTexCoord;
+    // to produce the color of each fragment, the layer is the same for the whole mesh
+    fragTexCoord = vec3(vertexTexCoord, textureLayer);
 
     // Output position of the vertex, in clip space : MVP * position
     gl_Position = MVP * v;
@@ -0,0 +1,49 @@
+#ifndef ASSET_PACK_H
+#define ASSET_PACK_H
+
+#include <stdint.h>
+#include <string.h>
+
+/* assets.pak : every shader, image, font and sound of the game in one file, built by
+ * pack_assets and memory mapped by the game at startup.
+ *
+ *   PackHeader
+ *   PackEntry[count], sorted by nameHash
+ *   file contents, each starting on a PACK_ALIGNMENT boundary
+ */
+
+const uint32_t PACK_VERSION = 1;
+const uint64_t PACK_ALIGNMENT = 16;
+
+/* How an entry is stored */
+enum PackCompression {
+	PACK_STORED = 0 // contents as they are on disk
+};
+
+struct PackHeader {
+	char magic[4];       // "APAK"
+	uint32_t version;
+	uint32_t count;      // entries in the index that follows
+	uint32_t reserved;
+};
+
+struct PackEntry {
+	uint64_t nameHash;   // packNameHash of the file name, unique within a pack
+	uint64_t offset;     // from the start of the pack
+	uint64_t size;       // bytes stored
+	uint32_t compression;
+	uint32_t reserved;
+};
+
+/* 64 bit FNV-1a of a file name, as passed to the game's loaders */
+inline uint64_t packNameHash (const char* name)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	for (size_t i=0; name[i]; i++) {
+		hash ^= (unsigned char) name[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+#endif
@@ -1,14 +1,15 @@
 #version 330 core
 
-// Interpolated values from the vertex shaders
-in vec3 fragColor;
+uniform sampler2D glyphAtlas;
+
+in vec2 fragUV;
+in vec4 fragColor;
 
 // output data
-out vec3 color;
+out vec4 color;
 
 void main()
 {
-    // Output color = color specified in the vertex shader,
-    // interpolated between all 3 surrounding vertices of the triangle
-    color = fragColor;
-}
\ No newline at end of file
+    // The atlas holds glyph coverage, blended over the scene
+    color = vec4(fragColor.rgb, fragColor.a * texture(glyphAtlas, fragUV).r);
+}
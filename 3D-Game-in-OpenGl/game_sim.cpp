@@ -0,0 +1,420 @@
+#include <cmath>
+#include <cstdlib>
+#include <algorithm>
+#include "game_sim.h"
+using namespace std;
+
+#define PI 3.14159
+
+int j;
+float j2=1,j4=-2,j5=2.2,j6=-2;
+int m=15;
+vector<int> num, num1;
+float t=0;
+bool flagjump= false;
+int layoutVersion=0;
+TileMask holeTiles, obstacleTiles;
+float wy=-2,obsy=0.0;
+int flagwater=0,flagobs=0,flagobs1=0;
+int score=0;
+int levelflag=1;
+int textflag=1;
+int life=4;
+bool gameEnded=false;
+int finalScore=0;
+float prev_j5=2.2, prev_wy=-2, prev_obsy=0.0;
+unsigned simEvents=0;
+
+BoardDesc board = { 10, 10, 0.4, -2, -2, -2.2f, -2.2f, 2.5f };
+
+double simTime=0, lastLayoutTime=0;
+
+/* Holes, obstacles, re-roll interval (s), obstacle and water speed per step, goal tile.
+ * The game ends after the last entry, adding a level is adding a row. */
+const LevelDesc levels[] = {
+	{ 15, 10, 4, 0.005, 0.01, 100 },
+	{ 15, 10, 3, 0.005, 0.01, 100 },
+	{ 15, 10, 2, 0.005, 0.01, 100 },
+	{ 15, 10, 1, 0.005, 0.01, 100 },
+};
+const int numLevels = sizeof(levels)/sizeof(levels[0]);
+
+/* Collision check of the current level, picked by enterLevel() */
+void (*levelCheck) (const LevelDesc& level);
+
+void setBoard (int cols, int rows, double pitch, double originX, double originZ)
+{
+	board.cols = cols < 2 ? 2 : cols;
+	board.rows = rows < 2 ? 2 : rows;
+	board.pitch = pitch;
+	board.originX = originX;
+	board.originZ = originZ;
+	board.edgeX = (float) (originX - pitch/2);
+	board.edgeZ = (float) (originZ - pitch/2);
+	board.invPitch = (float) (1/pitch);
+}
+
+int boardTiles ()
+{
+	return board.cols * board.rows;
+}
+
+int referenceTile (int q)
+{
+	int row = (q-1)/10 * (board.rows-1) / 9;
+	int col = (q-1)%10 * (board.cols-1) / 9;
+	int tile = row*board.cols + col + 1;
+	// On boards under 10x10 several tiles collapse onto the start tile, only tile 1 may stay there
+	if (tile == 1 && q != 1)
+		tile = 2;
+	return tile;
+}
+
+int scaledTileCount (int count)
+{
+	return (int) ((long long) count * boardTiles() / 100);
+}
+
+/* Tile under a board position, numbered from 1 like num[] and num1[], or 0 off the board */
+int tileAt (float x, float z)
+{
+	if (x < board.edgeX || z < board.edgeZ)
+		return 0;
+	int col = (int) ((x-board.edgeX)*board.invPitch);
+	int row = (int) ((z-board.edgeZ)*board.invPitch);
+	if (col >= board.cols || row >= board.rows)
+		return 0;
+	return row*board.cols + col + 1;
+}
+
+/* Centre of tile q on the board, the inverse of tileAt */
+float tileX (int q)
+{
+	return board.originX + ((q-1)%board.cols)*board.pitch;
+}
+
+float tileZ (int q)
+{
+	return board.originZ + ((q-1)/board.cols)*board.pitch;
+}
+
+bool isHoleTile (int q)
+{
+	return holeTiles.test(q);
+}
+
+bool isObstacleTile (int q)
+{
+	return obstacleTiles.test(q);
+}
+
+int countObstacleTiles ()
+{
+	return obstacleTiles.count();
+}
+
+/* Rebuild the bitboards from num[] and num1[], after either of them changed */
+void updateOccupancy ()
+{
+	holeTiles.reset(boardTiles());
+	obstacleTiles.reset(boardTiles());
+	for (size_t c=0; c<num.size(); c++)
+		holeTiles.set(num[c]);
+	for (size_t c=0; c<num1.size(); c++)
+		obstacleTiles.set(num1[c]);
+	layoutVersion++;
+}
+
+/* Properties of a level that are fixed at compile time, so the per-step check
+ * of a level without obstacles does not test for them */
+template <bool Obstacles>
+struct LevelTraits {
+	static const bool hasObstacles = Obstacles;
+};
+
+/* What the player at (x, y, z) runs into, given the obstacle height.
+ * Obstacles only count while obstaclesActive, the player clears them when jumping high enough. */
+template <class Traits>
+Collision collide (float x, float y, float z, float obstacleY, bool obstaclesActive)
+{
+	if (x<board.originX || z<board.originZ ||
+		x>board.originX + (board.cols-1)*board.pitch || z>board.originZ + (board.rows-1)*board.pitch)
+		return COLLISION_EDGE;
+
+	int q = tileAt(x, z);
+	if (isHoleTile(q))
+		return COLLISION_HOLE;
+	if (Traits::hasObstacles && obstaclesActive && isObstacleTile(q) && y<=3 && y>obstacleY+3)
+		return COLLISION_OBSTACLE;
+	return COLLISION_NONE;
+}
+
+Collision playerCollision (float x, float y, float z, float obstacleY, bool obstaclesActive)
+{
+	return collide< LevelTraits<true> >(x, y, z, obstacleY, obstaclesActive);
+}
+
+bool reachedGoal (float x, float z, int winTile)
+{
+	return tileAt(x, z) == winTile;
+}
+
+/* Back to the start corner, dropping any pending move */
+void resetPlayer ()
+{
+	j4=board.originX;
+	j6=board.originZ;
+	j=0;
+}
+
+/* Collision and goal check for one step, shared by every level */
+template <class Traits>
+void checkLevel (const LevelDesc& level)
+{
+	Collision hit = collide<Traits>(j4, j5, j6, obsy, flagobs1==0);
+	if (hit != COLLISION_NONE) {
+		resetPlayer();
+		life--;
+		score++;
+		if (hit == COLLISION_OBSTACLE) {
+			simEvents |= SIM_EVENT_OBSTACLE;
+			flagobs1=1;
+		}
+		else
+			simEvents |= SIM_EVENT_FALL;
+	}
+
+	if (reachedGoal(j4, j6, referenceTile(level.winTile))) {
+		resetPlayer();
+		levelflag++;
+		simEvents |= (levelflag > numLevels) ? SIM_EVENT_WIN : SIM_EVENT_LEVEL_UP;
+	}
+}
+
+const LevelDesc& currentLevel ()
+{
+	return levels[levelflag-1];
+}
+
+/* Switch the per-step check and the board size to levelflag's entry */
+void enterLevel ()
+{
+	const LevelDesc& level = currentLevel();
+	if (level.obstacles > 0)
+		levelCheck = checkLevel< LevelTraits<true> >;
+	else
+		levelCheck = checkLevel< LevelTraits<false> >;
+	m = scaledTileCount(level.holes);
+}
+
+/* Re-roll the holes (num[]) and obstacles (num1[]) */
+void regenerateLayout ()
+{
+	// A roll of 0 or in the last column moves to the tile before last, one under the player to tile 84's place
+	int spare = boardTiles() - 2;
+	int playerTile = tileAt(j4,j6);
+	num.assign(scaledTileCount(MAX_HOLES), 0);
+	for(int c=0;c<m;c++)
+	{
+		num[c]=rand()%spare+0;
+		if(num[c]%board.cols==0)
+		{
+			num[c]=spare;
+		}
+		else if(playerTile==num[c])
+		{
+			num[c]=referenceTile(84);
+		}
+	}
+	num1.assign(scaledTileCount(MAX_OBSTACLES), 0);
+	int obstacles = scaledTileCount(currentLevel().obstacles);
+	for(int c=0;c<obstacles;c++)
+	{
+		num1[c]=rand()%spare+0;
+		if(num1[c]%board.cols==0)
+		{
+			num1[c]=spare;
+		}
+		else if(playerTile==num1[c])
+		{
+			num1[c]=referenceTile(84);
+		}
+	}
+	updateOccupancy();
+}
+
+void resetGame ()
+{
+	j=0;
+	j2=1; j4=board.originX; j5=2.2; j6=board.originZ;
+	t=0;
+	flagjump=false;
+	wy=-2; obsy=0.0;
+	flagwater=0; flagobs=0; flagobs1=0;
+	score=0;
+	levelflag=1;
+	textflag=1;
+	life=4;
+	gameEnded=false;
+	finalScore=0;
+	prev_j5=j5; prev_wy=wy; prev_obsy=obsy;
+	simEvents=0;
+	simTime=0; lastLayoutTime=0;
+
+	enterLevel();
+
+	// Only the holes are rolled at start, obstacles appear with the first re-roll
+	num.assign(scaledTileCount(MAX_HOLES), 0);
+	for(int c=0;c<m;c++)
+		num[c]=rand()%(boardTiles()-2)+0;
+	num1.assign(scaledTileCount(MAX_OBSTACLES), 0);
+	updateOccupancy();
+}
+
+/* Move the obstacle pillars one step up or down */
+void stepObstacle (double speed)
+{
+	if(obsy<1 && flagobs==0)
+	{
+		obsy=obsy+speed;
+	}
+	else if(obsy>=1)
+	{
+		flagobs=1;
+		obsy=obsy-speed;
+	}
+	else if(flagobs==1 && obsy>-3)
+	{
+		obsy=obsy-speed;
+	}
+	else if(flagobs==1 && obsy<=-3)
+	{
+		obsy=obsy+speed;
+		flagobs=0;
+	}
+}
+
+/* Move the background water one step up or down */
+void stepWater (double speed)
+{
+	if(wy<1 && flagwater==0)
+	{
+		wy=wy+speed;
+	}
+	else if(wy>=1)
+	{
+		flagwater=1;
+		wy=wy-speed;
+	}
+	else if(flagwater==1 && wy>-3)
+	{
+		wy=wy-speed;
+	}
+	else if(flagwater==1 && wy<=-3)
+	{
+		wy=wy+speed;
+		flagwater=0;
+	}
+}
+
+/* Record the final score and end the game */
+void gameOver (int clearedLevels)
+{
+	textflag=(100*clearedLevels)-(5*score);
+	if(textflag<0)
+	{
+		textflag=0;
+	}
+	finalScore=textflag;
+	gameEnded=true;
+	simEvents |= SIM_EVENT_GAME_END;
+}
+
+/* Advance the game by one fixed step of SIM_DT seconds */
+void simulate ()
+{
+	prev_j5 = j5;
+	prev_wy = wy;
+	prev_obsy = obsy;
+
+	const LevelDesc& level = currentLevel();
+	int levelAtStart = levelflag;
+
+	stepWater(level.waterSpeed);
+
+	// Keep the start tile clear
+	if(isHoleTile(1) || isObstacleTile(1))
+	{
+		for(size_t c=0;c<num.size();c++)
+			if(num[c]==1)
+				num[c]=referenceTile(23);
+		for(size_t c=0;c<num1.size();c++)
+			if(num1[c]==1)
+				num1[c]=referenceTile(55);
+		updateOccupancy();
+	}
+
+	// Obstacles used to step once for every obstacle tile visited by the draw loop.
+	// Capped at the level's count, so they move as fast on a large board as on 10x10.
+	int obstacleSteps = min(countObstacleTiles(), level.obstacles);
+	for(int c=0;c<obstacleSteps;c++)
+		stepObstacle(level.obstacleSpeed);
+
+	// Player standing on a moving obstacle
+	if(flagobs1==1)
+		stepObstacle(level.obstacleSpeed);
+
+	// Apply the last key press, j2 times for the fast/slow speed setting
+	for(int k=0;k<j2 && j!=0;k++)
+	{
+		if(j==1)
+			j4 = flagjump ? j4+0.8 : j4+0.4;
+		else if(j==2)
+			j4 = flagjump ? j4-0.8 : j4-0.4;
+		else if(j==3)
+			j6 = flagjump ? j6-0.8 : j6-0.4;
+		else if(j==4)
+			j6 = flagjump ? j6+0.8 : j6+0.4;
+		else if(j==5 && j5>2.2)
+			flagjump=true;
+	}
+
+	if(flagjump==true)
+	{
+		if(j5>2.2)
+		{
+			float uy=(5*sin(90*(PI/180)));
+			j5=  2.2 + (uy*t-5*t*t);
+			t=t+0.1;
+		}
+		else if(!isObstacleTile(tileAt(j4,j6)))
+		{
+			t=0;
+			j5=2.2;
+			flagjump=false;
+		}
+	}
+	j=0;
+
+	if(life<1)
+	{
+		gameOver(levelflag-1);
+		return;
+	}
+
+	levelCheck(level);
+	if(levelflag > numLevels)
+	{
+		gameOver(levelflag);
+		return;
+	}
+	if(levelflag != levelAtStart)
+		enterLevel();
+
+	// Re-roll holes and obstacles every regenSeconds of simulation time
+	simTime += SIM_DT;
+	if ((simTime - lastLayoutTime) >= currentLevel().regenSeconds) {
+		regenerateLayout();
+		lastLayoutTime = simTime;
+	}
+}
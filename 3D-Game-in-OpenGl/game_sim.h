@@ -0,0 +1,145 @@
+#ifndef GAME_SIM_H
+#define GAME_SIM_H
+
+#include <stdint.h>
+#include <vector>
+
+/* Game rules, with no OpenGL, GLFW or SFML dependency.
+ * Sample_GL3_2D.cpp renders this state, headless_main.cpp steps it without a window. */
+
+/* Simulation runs at a fixed rate, independent of how fast frames are rendered */
+/* 60 Hz matches the vsynced frame rate all the per-step increments were tuned for */
+const double SIM_DT = 1.0/60.0;
+
+/* Things that happened during a step, for the caller to play sounds or print messages */
+enum SimEvent {
+	SIM_EVENT_FALL     = 1 << 0, // fell off the board or into a hole
+	SIM_EVENT_OBSTACLE = 1 << 1, // hit an obstacle
+	SIM_EVENT_LEVEL_UP = 1 << 2, // reached the opposite corner
+	SIM_EVENT_WIN      = 1 << 3, // reached the opposite corner on the last level
+	SIM_EVENT_GAME_END = 1 << 4  // out of lives or past the last level, see finalScore
+};
+
+/* Player : j is the pending move (1 right, 2 left, 3 up, 4 down, 5 jump), j2 the moves per key */
+extern int j;
+extern float j2, j4, j5, j6;
+extern float t;
+extern bool flagjump;
+
+/* One row of the level table */
+struct LevelDesc {
+	int holes;            // hole tiles rolled each time, at most MAX_HOLES
+	int obstacles;        // obstacle tiles rolled each time, at most MAX_OBSTACLES
+	int regenSeconds;     // seconds between re-rolls of the board
+	double obstacleSpeed; // obstacle height change per step
+	double waterSpeed;    // water height change per step
+	int winTile;          // reaching this tile clears the level, see referenceTile
+};
+
+extern const LevelDesc levels[];
+extern const int numLevels;
+
+/* Entry for levelflag, which counts from 1 */
+const LevelDesc& currentLevel ();
+
+/* Board geometry : cols x rows tiles, 'pitch' apart, with tile 1 centred on (originX, originZ).
+ * Tiles are numbered from 1, row by row. The default is the original 10x10 board. */
+struct BoardDesc {
+	int cols, rows;
+	double pitch;
+	double originX, originZ;
+	float edgeX, edgeZ; // outer edge of the first row and column
+	float invPitch;
+};
+
+extern BoardDesc board;
+
+/* Change the board, then call resetGame */
+void setBoard (int cols, int rows, double pitch, double originX, double originZ);
+int boardTiles ();
+
+/* Tile at the same relative place as tile q of a 10x10 board, so the level table and the
+ * fixed tiles of the rules work on any board size. Corners map to corners, and only
+ * tile 1 maps to the start tile. */
+int referenceTile (int q);
+
+/* Tiles on this board for 'count' tiles on a 10x10 board, keeping their density */
+int scaledTileCount (int count);
+
+/* Board : num[] holds the m hole tiles, num1[] the obstacle tiles, numbered from 1, 0 for none */
+const int MAX_HOLES = 15;     // per 100 tiles
+const int MAX_OBSTACLES = 10; // per 100 tiles
+extern int m;
+extern std::vector<int> num, num1;
+extern int layoutVersion; // changes whenever num[] or num1[] change
+
+/* One bit per tile, bit q-1 for tile q, so membership is a single test */
+struct TileMask {
+	std::vector<uint64_t> bits;
+	int tiles;
+	int bitsSet;
+
+	TileMask () : tiles(0), bitsSet(0) {}
+	void reset (int n) { bits.assign((n + 63) >> 6, 0); tiles = n; bitsSet = 0; }
+	void set (int q)
+	{
+		if (q < 1 || q > tiles)
+			return;
+		uint64_t bit = (uint64_t) 1 << ((q-1) & 63);
+		if (!(bits[(q-1) >> 6] & bit))
+			bitsSet++;
+		bits[(q-1) >> 6] |= bit;
+	}
+	bool test (int q) const { return q >= 1 && q <= tiles && (bits[(q-1) >> 6] >> ((q-1) & 63) & 1); }
+	int count () const { return bitsSet; }
+};
+
+/* Built from num[] and num1[] by updateOccupancy() */
+extern TileMask holeTiles, obstacleTiles;
+
+/* Moving water and obstacles */
+extern float wy, obsy;
+extern int flagwater, flagobs, flagobs1;
+
+/* Progress */
+extern int score, levelflag, textflag, life;
+extern bool gameEnded;
+extern int finalScore;
+
+/* Values from the previous simulation step, blended with the current ones when rendering */
+extern float prev_j5, prev_wy, prev_obsy;
+
+/* Events raised since the caller last cleared this mask */
+extern unsigned simEvents;
+
+/* What the player ran into, if anything */
+enum Collision {
+	COLLISION_NONE,
+	COLLISION_EDGE,     // walked off the board
+	COLLISION_HOLE,
+	COLLISION_OBSTACLE
+};
+
+/* Tile lookups, tiles are numbered 1..boardTiles() row by row from the origin corner */
+int tileAt (float x, float z);
+float tileX (int q);
+float tileZ (int q);
+bool isHoleTile (int q);
+bool isObstacleTile (int q);
+int countObstacleTiles ();
+void updateOccupancy ();
+
+/* Pure collision tests, they only read the board */
+Collision playerCollision (float x, float y, float z, float obstacleY, bool obstaclesActive);
+bool reachedGoal (float x, float z, int winTile);
+
+/* Re-roll the holes (num[]) and obstacles (num1[]) */
+void regenerateLayout ();
+
+/* Put every gameplay variable back to its start-of-game value */
+void resetGame ();
+
+/* Advance the game by one fixed step of SIM_DT seconds */
+void simulate ();
+
+#endif
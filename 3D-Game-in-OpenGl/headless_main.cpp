@@ -0,0 +1,97 @@
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <chrono>
+
+#include "game_sim.h"
+using namespace std;
+
+/* Headless driver : steps the game rules with no window, GL context or audio.
+ * A simple bot presses a key every few steps, heading for the winning corner. */
+
+/* Small LCG so the bot does not disturb the rand() sequence used for the board */
+unsigned botState = 12345;
+
+unsigned botRand ()
+{
+	botState = botState*1103515245u + 12345u;
+	return (botState >> 16) & 0x7FFF;
+}
+
+/* Pick the next key press : mostly right (1) and down (4), sometimes left/up or a jump */
+int botMove ()
+{
+	unsigned r = botRand() % 10;
+	if (r < 4)
+		return 1;
+	if (r < 8)
+		return 4;
+	if (r < 9)
+		return 5;
+	return 2 + (botRand() % 2);
+}
+
+int main (int argc, char** argv)
+{
+	long long steps = 10000000;
+	int keyInterval = 15; // steps between key presses, 4 per second at 60 Hz
+
+	for (int a=1; a<argc; a++) {
+		if (strncmp(argv[a], "--steps=", 8) == 0)
+			steps = atoll(argv[a] + 8);
+		else if (strncmp(argv[a], "--key-interval=", 15) == 0)
+			keyInterval = atoi(argv[a] + 15);
+		else if (strncmp(argv[a], "--board=", 8) == 0) {
+			int cols = 10, rows = 10;
+			sscanf(argv[a] + 8, "%dx%d", &cols, &rows);
+			setBoard(cols, rows, board.pitch, board.originX, board.originZ);
+		}
+		else {
+			cout << "Usage: " << argv[0] << " [--steps=N] [--key-interval=N] [--board=COLSxROWS]" << endl;
+			return 1;
+		}
+	}
+	if (keyInterval < 1)
+		keyInterval = 1;
+
+	resetGame();
+
+	long long games = 0, levelsCleared = 0, totalScore = 0, falls = 0, hits = 0;
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+	for (long long s=0; s<steps; s++) {
+		if (s % keyInterval == 0)
+			j = botMove();
+
+		simulate();
+
+		if (simEvents & SIM_EVENT_FALL)
+			falls++;
+		if (simEvents & SIM_EVENT_OBSTACLE)
+			hits++;
+		if (simEvents & (SIM_EVENT_LEVEL_UP | SIM_EVENT_WIN))
+			levelsCleared++;
+		simEvents = 0;
+
+		if (gameEnded) {
+			games++;
+			totalScore += finalScore;
+			resetGame();
+		}
+	}
+
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+	cout << "Board:          " << board.cols << "x" << board.rows << endl;
+	cout << "Steps:          " << steps << " (" << steps*SIM_DT << " s of game time)" << endl;
+	cout << "Wall time:      " << seconds << " s" << endl;
+	cout << "Steps/second:   " << (seconds > 0 ? steps/seconds : 0) << endl;
+	cout << "Games finished: " << games << endl;
+	cout << "Levels cleared: " << levelsCleared << endl;
+	cout << "Falls / hits:   " << falls << " / " << hits << endl;
+	if (games)
+		cout << "Average score:  " << (double) totalScore/games << endl;
+
+	return 0;
+}
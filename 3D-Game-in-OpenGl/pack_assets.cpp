@@ -0,0 +1,85 @@
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+
+#include "asset_pack.h"
+using namespace std;
+
+/* Asset packer : writes the files named on the command line into one pack, see asset_pack.h.
+ * Run by 'make assets.pak', the game then needs no loose files next to it. */
+
+struct PackFile {
+	PackEntry entry;
+	const char* name;
+	vector<char> data;
+};
+
+bool compareEntries (const PackFile& a, const PackFile& b)
+{
+	return a.entry.nameHash < b.entry.nameHash;
+}
+
+int main (int argc, char** argv)
+{
+	if (argc < 3) {
+		cout << "Usage: " << argv[0] << " PACK FILE..." << endl;
+		return 1;
+	}
+
+	vector<PackFile> files(argc - 2);
+	for (int a=2; a<argc; a++) {
+		PackFile& file = files[a-2];
+		file.name = argv[a];
+		ifstream in(file.name, ios::binary);
+		if (!in.is_open()) {
+			cout << "Could not read " << file.name << endl;
+			return 1;
+		}
+		file.data.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+		file.entry.nameHash = packNameHash(file.name);
+		file.entry.size = file.data.size();
+		file.entry.compression = PACK_STORED;
+		file.entry.reserved = 0;
+	}
+
+	// Sorted index for binary search, names must not collide
+	sort(files.begin(), files.end(), compareEntries);
+	for (size_t i=1; i<files.size(); i++)
+		if (files[i].entry.nameHash == files[i-1].entry.nameHash) {
+			cout << "Duplicate name hash: " << files[i-1].name << " and " << files[i].name << endl;
+			return 1;
+		}
+
+	PackHeader header;
+	memcpy(header.magic, "APAK", 4);
+	header.version = PACK_VERSION;
+	header.count = files.size();
+	header.reserved = 0;
+
+	uint64_t offset = sizeof(PackHeader) + files.size()*sizeof(PackEntry);
+	for (size_t i=0; i<files.size(); i++) {
+		offset = (offset + PACK_ALIGNMENT - 1) & ~(PACK_ALIGNMENT - 1);
+		files[i].entry.offset = offset;
+		offset += files[i].entry.size;
+	}
+
+	ofstream out(argv[1], ios::binary);
+	out.write((const char*) &header, sizeof(header));
+	for (size_t i=0; i<files.size(); i++)
+		out.write((const char*) &files[i].entry, sizeof(PackEntry));
+	for (size_t i=0; i<files.size(); i++) {
+		static const char padding[PACK_ALIGNMENT] = { 0 };
+		out.write(padding, files[i].entry.offset - (uint64_t) out.tellp());
+		if (!files[i].data.empty())
+			out.write(&files[i].data[0], files[i].data.size());
+	}
+	if (!out) {
+		cout << "Could not write " << argv[1] << endl;
+		return 1;
+	}
+
+	cout << "Packed " << files.size() << " files into " << argv[1] << " (" << offset << " bytes)" << endl;
+	return 0;
+}